@@ -16,7 +16,14 @@
 #include <dlfcn.h>
 #endif
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/DebugInfo.h"
@@ -40,6 +47,31 @@
 using namespace oclgrind;
 using namespace std;
 
+// Get the listener list index for a plugin event flag
+static constexpr unsigned getEventIndex(unsigned event)
+{
+  return event > 1 ? 1 + getEventIndex(event >> 1) : 0;
+}
+
+struct Context::WorkerPool
+{
+  std::vector<std::thread> threads;
+  bool pinThreads;
+
+  // Serialises kernel launches that share this pool
+  std::mutex launchMutex;
+
+  // Current job, guarded by mutex
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable finish;
+  std::function<void(unsigned)> job;
+  unsigned generation;
+  unsigned numActive;
+  unsigned running;
+  bool shutdown;
+};
+
 Context::Context()
 {
   m_llvmContext = new llvm::LLVMContext;
@@ -47,16 +79,88 @@ Context::Context()
   m_globalMemory = new Memory(AddrSpaceGlobal, sizeof(size_t)==8 ? 16 : 8,
                               this);
   m_kernelInvocation = NULL;
+  m_instrumented = !checkEnv("OCLGRIND_NO_INSTRUMENTATION");
+  m_programCacheHits = 0;
+  m_programCacheDiskHits = 0;
+  m_programCacheMisses = 0;
+
+  // Check for user overriding number of threads
+  m_numWorkers = 0;
+  const char *numThreads = getenv("OCLGRIND_NUM_THREADS");
+  if (numThreads)
+  {
+    char *next;
+    m_numWorkers = strtoul(numThreads, &next, 10);
+    if (strlen(next))
+    {
+      cerr << "Oclgrind: Invalid value for OCLGRIND_NUM_THREADS" << endl;
+    }
+  }
+  else
+  {
+    m_numWorkers = thread::hardware_concurrency();
+  }
+  if (!m_numWorkers)
+    m_numWorkers = 1;
 
+  m_workerPool = new WorkerPool;
+  m_workerPool->pinThreads = checkEnv("OCLGRIND_PIN_THREADS");
+  m_workerPool->generation = 0;
+  m_workerPool->numActive = 0;
+  m_workerPool->running = 0;
+  m_workerPool->shutdown = false;
+
+  m_eventListeners.resize(Plugin::NUM_EVENTS);
   loadPlugins();
 }
 
 Context::~Context()
 {
+  // Stop worker threads
+  {
+    lock_guard<mutex> lock(m_workerPool->mutex);
+    m_workerPool->shutdown = true;
+  }
+  m_workerPool->start.notify_all();
+  for (thread& t : m_workerPool->threads)
+    t.join();
+  delete m_workerPool;
+
   delete m_llvmContext;
   delete m_globalMemory;
 
   unloadPlugins();
+
+  // Statistics are only reported on request, to keep application output
+  // unchanged
+  if (checkEnv("OCLGRIND_STATS") &&
+      (m_programCacheHits || m_programCacheMisses))
+  {
+    cerr << "Oclgrind: program cache: "
+         << m_programCacheHits << " hits ("
+         << m_programCacheDiskHits << " from disk), "
+         << m_programCacheMisses << " misses" << endl;
+  }
+  Program::BuildCacheStats buildCache = Program::getBuildCacheStats();
+  if (checkEnv("OCLGRIND_STATS") && (buildCache.hits || buildCache.misses))
+  {
+    cerr << "Oclgrind: build cache: "
+         << buildCache.hits << " hits, "
+         << buildCache.misses << " misses, "
+         << buildCache.evictions << " evictions, "
+         << buildCache.entries << " entries ("
+         << buildCache.bytes << " bytes)" << endl;
+  }
+}
+
+bool Context::hasEventListeners(unsigned event) const
+{
+  return !m_eventListeners[getEventIndex(event)].empty();
+}
+
+bool Context::isInstrumented() const
+{
+  return m_instrumented;
 }
 
 bool Context::isThreadSafe() const
@@ -69,6 +173,16 @@ bool Context::isThreadSafe() const
   return true;
 }
 
+bool Context::supportsParallelWorkItems() const
+{
+  for (const PluginEntry &p : m_plugins)
+  {
+    if (!p.first->isThreadSafe() || !p.first->supportsParallelWorkItems())
+      return false;
+  }
+  return true;
+}
+
 Memory* Context::getGlobalMemory() const
 {
   return m_globalMemory;
@@ -79,10 +193,52 @@ llvm::LLVMContext* Context::getLLVMContext() const
   return m_llvmContext;
 }
 
+mutex& Context::getLLVMContextMutex() const
+{
+  return m_llvmContextMutex;
+}
+
+recursive_mutex& Context::getGlobalMemoryMutex() const
+{
+  return m_globalMemoryMutex;
+}
+
+unsigned Context::getNumWorkers() const
+{
+  return m_numWorkers;
+}
+
 void Context::loadPlugins()
 {
   // Create core plugins
   m_plugins.push_back(make_pair(new Logger(this), true));
+
+  // Error reporting is the only analysis available without instrumentation
+  if (!m_instrumented)
+  {
+    const char *plugins[][2] =
+    {
+      {"OCLGRIND_INST_COUNTS",   "instruction counter"},
+      {"OCLGRIND_DATA_RACES",    "data-race detector"},
+      {"OCLGRIND_UNINITIALIZED", "uninitialized value checker"},
+      {"OCLGRIND_INTERACTIVE",   "interactive debugger"},
+    };
+    for (unsigned i = 0; i < sizeof(plugins)/sizeof(plugins[0]); i++)
+    {
+      if (checkEnv(plugins[i][0]))
+        cerr << "Oclgrind: Not loading " << plugins[i][1]
+             << ", as instrumentation is disabled" << endl;
+    }
+
+    const char *dynamicPlugins = getenv("OCLGRIND_PLUGINS");
+    if (dynamicPlugins && strlen(dynamicPlugins))
+      cerr << "Oclgrind: Not loading plugins '" << dynamicPlugins
+           << "', as instrumentation is disabled" << endl;
+
+    updateEventListeners();
+    return;
+  }
+
   m_plugins.push_back(make_pair(new MemCheck(this), true));
 
   if (checkEnv("OCLGRIND_INST_COUNTS"))
@@ -144,6 +300,8 @@ void Context::loadPlugins()
       m_pluginLibraries.push_back(library);
     }
   }
+
+  updateEventListeners();
 }
 
 void Context::unloadPlugins()
@@ -179,16 +337,119 @@ void Context::unloadPlugins()
   }
 
   m_plugins.clear();
+  updateEventListeners();
 }
 
 void Context::registerPlugin(Plugin *plugin)
 {
+  if (!m_instrumented)
+    cerr << "Oclgrind: Registered plugin will not receive memory or "
+         << "instruction events, as instrumentation is disabled" << endl;
+
   m_plugins.push_back(make_pair(plugin, false));
+  updateEventListeners();
 }
 
 void Context::unregisterPlugin(Plugin *plugin)
 {
   m_plugins.remove(make_pair(plugin, false));
+  updateEventListeners();
+}
+
+void Context::updateEventListeners()
+{
+  for (unsigned i = 0; i < Plugin::NUM_EVENTS; i++)
+  {
+    m_eventListeners[i].clear();
+  }
+
+  // Build list of subscribed plugins for each event
+  PluginList::iterator pItr;
+  for (pItr = m_plugins.begin(); pItr != m_plugins.end(); pItr++)
+  {
+    unsigned events = pItr->first->getEventMask();
+    for (unsigned i = 0; i < Plugin::NUM_EVENTS; i++)
+    {
+      if (events & (1 << i))
+        m_eventListeners[i].push_back(pItr->first);
+    }
+  }
+}
+
+void Context::runPoolThread(WorkerPool *pool, unsigned index,
+                            unsigned generation)
+{
+#if defined(__linux__)
+  if (pool->pinThreads)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % thread::hardware_concurrency(), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+  }
+#endif
+
+  while (true)
+  {
+    // Wait for the next job
+    {
+      unique_lock<mutex> lock(pool->mutex);
+      pool->start.wait(lock, [&]{
+        return pool->shutdown || pool->generation != generation;
+      });
+      if (pool->shutdown)
+        return;
+
+      generation = pool->generation;
+      if (index >= pool->numActive)
+        continue;
+    }
+
+    pool->job(index);
+
+    lock_guard<mutex> lock(pool->mutex);
+    if (--pool->running == 0)
+      pool->finish.notify_one();
+  }
+}
+
+void Context::runWorkers(const function<void(unsigned)>& job,
+                         unsigned numWorkers) const
+{
+  // Run in the calling thread if there is only one worker
+  if (numWorkers <= 1)
+  {
+    job(0);
+    return;
+  }
+
+  WorkerPool *pool = m_workerPool;
+  lock_guard<mutex> launch(pool->launchMutex);
+
+  {
+    lock_guard<mutex> lock(pool->mutex);
+
+    // Start any additional threads needed
+    while (pool->threads.size() < numWorkers-1)
+    {
+      unsigned index = pool->threads.size() + 1;
+      pool->threads.push_back(thread(runPoolThread, pool, index,
+                                     pool->generation));
+    }
+
+    pool->job       = job;
+    pool->numActive = numWorkers;
+    pool->running   = numWorkers-1;
+    pool->generation++;
+  }
+  pool->start.notify_all();
+
+  // The calling thread acts as worker 0
+  job(0);
+
+  unique_lock<mutex> lock(pool->mutex);
+  pool->finish.wait(lock, [&]{ return pool->running == 0; });
+  pool->job = nullptr;
 }
 
 void Context::logError(const char* error) const
@@ -202,21 +463,34 @@ void Context::logError(const char* error) const
   msg.send();
 }
 
-#define NOTIFY(function, ...)                     \
-{                                                 \
-  PluginList::const_iterator pluginItr;           \
-  for (pluginItr = m_plugins.begin();             \
-       pluginItr != m_plugins.end(); pluginItr++) \
-  {                                               \
-    pluginItr->first->function(__VA_ARGS__);      \
-  }                                               \
+void Context::recordProgramCacheLookup(bool hit, bool onDisk) const
+{
+  if (hit)
+    m_programCacheHits++;
+  else
+    m_programCacheMisses++;
+  if (onDisk)
+    m_programCacheDiskHits++;
+}
+
+#define NOTIFY(event, function, ...)                  \
+{                                                     \
+  const vector<Plugin*>& listeners =                  \
+    m_eventListeners[getEventIndex(Plugin::event)];   \
+  vector<Plugin*>::const_iterator pluginItr;          \
+  for (pluginItr = listeners.begin();                 \
+       pluginItr != listeners.end(); pluginItr++)     \
+  {                                                   \
+    (*pluginItr)->function(__VA_ARGS__);              \
+  }                                                   \
 }
 
 void Context::notifyInstructionExecuted(const WorkItem *workItem,
                                         const llvm::Instruction *instruction,
                                         const TypedValue& result) const
 {
-  NOTIFY(instructionExecuted, workItem, instruction, result);
+  NOTIFY(INSTRUCTION_EXECUTED,
+         instructionExecuted, workItem, instruction, result);
 }
 
 void Context::notifyKernelBegin(const KernelInvocation *kernelInvocation) const
@@ -224,12 +498,12 @@ void Context::notifyKernelBegin(const KernelInvocation *kernelInvocation) const
   assert(m_kernelInvocation == NULL);
   m_kernelInvocation = kernelInvocation;
 
-  NOTIFY(kernelBegin, kernelInvocation);
+  NOTIFY(KERNEL_BEGIN, kernelBegin, kernelInvocation);
 }
 
 void Context::notifyKernelEnd(const KernelInvocation *kernelInvocation) const
 {
-  NOTIFY(kernelEnd, kernelInvocation);
+  NOTIFY(KERNEL_END, kernelEnd, kernelInvocation);
 
   assert(m_kernelInvocation == kernelInvocation);
   m_kernelInvocation = NULL;
@@ -239,15 +513,20 @@ void Context::notifyMemoryAllocated(const Memory *memory, size_t address,
                                     size_t size, cl_mem_flags flags,
                                     const uint8_t *initData) const
 {
-  NOTIFY(memoryAllocated, memory, address, size, flags, initData);
+  NOTIFY(MEMORY_ALLOCATED,
+         memoryAllocated, memory, address, size, flags, initData);
 }
 
 void Context::notifyMemoryAtomicLoad(const Memory *memory, AtomicOp op,
                                      size_t address, size_t size) const
 {
+  if (!hasEventListeners(Plugin::MEMORY_ATOMIC_LOAD))
+    return;
+
   if (m_kernelInvocation && m_kernelInvocation->getCurrentWorkItem())
   {
-    NOTIFY(memoryAtomicLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
+    NOTIFY(MEMORY_ATOMIC_LOAD,
+           memoryAtomicLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
            op, address, size);
   }
 }
@@ -255,9 +534,13 @@ void Context::notifyMemoryAtomicLoad(const Memory *memory, AtomicOp op,
 void Context::notifyMemoryAtomicStore(const Memory *memory, AtomicOp op,
                                       size_t address, size_t size) const
 {
+  if (!hasEventListeners(Plugin::MEMORY_ATOMIC_STORE))
+    return;
+
   if (m_kernelInvocation && m_kernelInvocation->getCurrentWorkItem())
   {
-    NOTIFY(memoryAtomicStore, memory, m_kernelInvocation->getCurrentWorkItem(),
+    NOTIFY(MEMORY_ATOMIC_STORE,
+           memoryAtomicStore, memory, m_kernelInvocation->getCurrentWorkItem(),
            op, address, size);
   }
 }
@@ -265,7 +548,7 @@ void Context::notifyMemoryAtomicStore(const Memory *memory, AtomicOp op,
 void Context::notifyMemoryDeallocated(const Memory *memory,
                                       size_t address) const
 {
-  NOTIFY(memoryDeallocated, memory, address);
+  NOTIFY(MEMORY_DEALLOCATED, memoryDeallocated, memory, address);
 }
 
 void Context::notifyMemoryLoad(const Memory *memory, size_t address,
@@ -273,20 +556,25 @@ void Context::notifyMemoryLoad(const Memory *memory, size_t address,
 {
   if (m_kernelInvocation)
   {
+    if (!hasEventListeners(Plugin::MEMORY_LOAD))
+      return;
+
     if (m_kernelInvocation->getCurrentWorkItem())
     {
-      NOTIFY(memoryLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
+      NOTIFY(MEMORY_LOAD,
+             memoryLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
              address, size);
     }
     else if (m_kernelInvocation->getCurrentWorkGroup())
     {
-      NOTIFY(memoryLoad, memory, m_kernelInvocation->getCurrentWorkGroup(),
+      NOTIFY(MEMORY_LOAD,
+             memoryLoad, memory, m_kernelInvocation->getCurrentWorkGroup(),
              address, size);
     }
   }
   else
   {
-    NOTIFY(hostMemoryLoad, memory, address, size);
+    NOTIFY(HOST_MEMORY_LOAD, hostMemoryLoad, memory, address, size);
   }
 }
 
@@ -294,7 +582,7 @@ void Context::notifyMemoryMap(const Memory *memory, size_t address,
                               size_t offset, size_t size,
                               cl_mem_flags flags) const
 {
-  NOTIFY(memoryMap, memory, address, offset, size, flags);
+  NOTIFY(MEMORY_MAP, memoryMap, memory, address, offset, size, flags);
 }
 
 void Context::notifyMemoryStore(const Memory *memory, size_t address,
@@ -302,58 +590,64 @@ void Context::notifyMemoryStore(const Memory *memory, size_t address,
 {
   if (m_kernelInvocation)
   {
+    if (!hasEventListeners(Plugin::MEMORY_STORE))
+      return;
+
     if (m_kernelInvocation->getCurrentWorkItem())
     {
-      NOTIFY(memoryStore, memory, m_kernelInvocation->getCurrentWorkItem(),
+      NOTIFY(MEMORY_STORE,
+             memoryStore, memory, m_kernelInvocation->getCurrentWorkItem(),
              address, size, storeData);
     }
     else if (m_kernelInvocation->getCurrentWorkGroup())
     {
-      NOTIFY(memoryStore, memory, m_kernelInvocation->getCurrentWorkGroup(),
+      NOTIFY(MEMORY_STORE,
+             memoryStore, memory, m_kernelInvocation->getCurrentWorkGroup(),
              address, size, storeData);
     }
   }
   else
   {
-    NOTIFY(hostMemoryStore, memory, address, size, storeData);
+    NOTIFY(HOST_MEMORY_STORE,
+           hostMemoryStore, memory, address, size, storeData);
   }
 }
 
 void Context::notifyMessage(MessageType type, const char *message) const
 {
-  NOTIFY(log, type, message);
+  NOTIFY(LOG, log, type, message);
 }
 
 void Context::notifyMemoryUnmap(const Memory *memory, size_t address,
                                 const void *ptr) const
 {
-  NOTIFY(memoryUnmap, memory, address, ptr);
+  NOTIFY(MEMORY_UNMAP, memoryUnmap, memory, address, ptr);
 }
 
 void Context::notifyWorkGroupBarrier(const WorkGroup *workGroup,
                                      uint32_t flags) const
 {
-  NOTIFY(workGroupBarrier, workGroup, flags);
+  NOTIFY(WORK_GROUP_BARRIER, workGroupBarrier, workGroup, flags);
 }
 
 void Context::notifyWorkGroupBegin(const WorkGroup *workGroup) const
 {
-  NOTIFY(workGroupBegin, workGroup);
+  NOTIFY(WORK_GROUP_BEGIN, workGroupBegin, workGroup);
 }
 
 void Context::notifyWorkGroupComplete(const WorkGroup *workGroup) const
 {
-  NOTIFY(workGroupComplete, workGroup);
+  NOTIFY(WORK_GROUP_COMPLETE, workGroupComplete, workGroup);
 }
 
 void Context::notifyWorkItemBegin(const WorkItem *workItem) const
 {
-  NOTIFY(workItemBegin, workItem);
+  NOTIFY(WORK_ITEM_BEGIN, workItemBegin, workItem);
 }
 
 void Context::notifyWorkItemComplete(const WorkItem *workItem) const
 {
-  NOTIFY(workItemComplete, workItem);
+  NOTIFY(WORK_ITEM_COMPLETE, workItemComplete, workItem);
 }
 
 #undef NOTIFY
@@ -8,6 +8,10 @@
 
 #include "common.h"
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+
 namespace llvm
 {
   class LLVMContext;
@@ -31,9 +35,16 @@ namespace oclgrind
     virtual ~Context();
 
     Memory* getGlobalMemory() const;
+    std::recursive_mutex& getGlobalMemoryMutex() const;
     llvm::LLVMContext* getLLVMContext() const;
+    std::mutex& getLLVMContextMutex() const;
+    unsigned getNumWorkers() const;
+    bool hasEventListeners(unsigned event) const;
+    bool isInstrumented() const;
     bool isThreadSafe() const;
+    bool supportsParallelWorkItems() const;
     void logError(const char* error) const;
+    void recordProgramCacheLookup(bool hit, bool onDisk) const;
 
     // Simulation callbacks
     void notifyInstructionExecuted(const WorkItem *workItem,
@@ -70,16 +81,42 @@ namespace oclgrind
     void registerPlugin(Plugin *plugin);
     void unregisterPlugin(Plugin *plugin);
 
+    // Run a job on numWorkers threads, with worker 0 in the calling thread
+    void runWorkers(const std::function<void(unsigned)>& job,
+                    unsigned numWorkers) const;
+
   private:
     mutable const KernelInvocation *m_kernelInvocation;
     Memory *m_globalMemory;
+    bool m_instrumented;
 
     PluginList m_plugins;
     std::list<void*> m_pluginLibraries;
     void loadPlugins();
     void unloadPlugins();
 
+    // Plugins subscribed to each event
+    std::vector< std::vector<Plugin*> > m_eventListeners;
+    void updateEventListeners();
+
     llvm::LLVMContext *m_llvmContext;
+    mutable std::mutex m_llvmContextMutex;
+
+    // Serialises global buffer allocation with other users of global
+    // memory, since programs may be built on background threads
+    mutable std::recursive_mutex m_globalMemoryMutex;
+
+    // Program cache statistics, across the in-process and on-disk caches
+    mutable std::atomic<size_t> m_programCacheHits;
+    mutable std::atomic<size_t> m_programCacheDiskHits;
+    mutable std::atomic<size_t> m_programCacheMisses;
+
+    // Persistent worker threads, started on first use
+    struct WorkerPool;
+    WorkerPool *m_workerPool;
+    unsigned m_numWorkers;
+    static void runPoolThread(WorkerPool *pool, unsigned index,
+                              unsigned generation);
 
   public:
     class Message
@@ -10,12 +10,12 @@
 
 #include <atomic>
 #include <sstream>
-#include <thread>
 
 #include "Context.h"
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
+#include "Plugin.h"
 #include "Program.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
@@ -25,12 +25,11 @@ using namespace std;
 
 struct
 {
+  unsigned   workerIndex;
   WorkGroup *workGroup;
   WorkItem  *workItem;
 } static THREAD_LOCAL workerState;
 
-static atomic<unsigned> nextGroupIndex;
-
 KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
                                    unsigned int workDim,
                                    Size3 globalOffset,
@@ -53,24 +52,63 @@ KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
     m_numGroups.z += m_globalSize.z % m_localSize.z ? 1 : 0;
   }
 
-  // Check for user overriding number of threads
-  m_numWorkers = 0;
-  const char *numThreads = getenv("OCLGRIND_NUM_THREADS");
-  if (numThreads)
+  // Use the context's worker threads if all plugins are thread-safe
+  m_numWorkers = m_context->getNumWorkers();
+  if (!m_context->isThreadSafe())
+    m_numWorkers = 1;
+
+  // Check for running work-items from the same work-group in parallel
+  m_parallelWorkItems = m_numWorkers > 1 &&
+                        checkEnv("OCLGRIND_PARALLEL_WORK_ITEMS") &&
+                        m_context->supportsParallelWorkItems();
+  if (checkEnv("OCLGRIND_PARALLEL_WORK_ITEMS") && !m_parallelWorkItems)
+  {
+    Context::Message msg(INFO, m_context);
+    msg << "Running work-items serially, as parallel work-items need "
+        << "multiple threads and plugins that support them" << endl;
+    msg.send();
+  }
+  m_workers = new Worker[m_numWorkers];
+  for (unsigned i = 0; i < m_numWorkers; i++)
+    m_workers[i].spareGroup = NULL;
+
+  // Check for storing work-item values in per-work-group register files
+  m_groupRegisters = checkEnv("OCLGRIND_GROUP_REGISTERS");
+
+  // Check for single-stepping instead of running work-items to barriers
+  m_singleStep = checkEnv("OCLGRIND_SINGLE_STEP");
+
+  // Check for running chunks of work-items in lockstep
+  m_lockstepWidth = 0;
+  const char *lockstepWidth = getenv("OCLGRIND_LOCKSTEP_WIDTH");
+  if (lockstepWidth)
   {
     char *next;
-    m_numWorkers = strtoul(numThreads, &next, 10);
+    m_lockstepWidth = strtoul(lockstepWidth, &next, 10);
     if (strlen(next))
     {
-      cerr << "Oclgrind: Invalid value for OCLGRIND_NUM_THREADS" << endl;
+      cerr << "Oclgrind: Invalid value for OCLGRIND_LOCKSTEP_WIDTH" << endl;
+      m_lockstepWidth = 0;
     }
   }
-  else
-  {
-    m_numWorkers = thread::hardware_concurrency();
-  }
-  if (!m_numWorkers || !m_context->isThreadSafe())
-    m_numWorkers = 1;
+  if (m_parallelWorkItems || m_singleStep)
+    m_lockstepWidth = 0;
+
+  // Lockstep execution operates on lanes of the work-group register file
+  if (m_lockstepWidth)
+    m_groupRegisters = true;
+  m_lanesVectorised = 0;
+
+  // Check for sharing uniform results between work-items, which is not
+  // possible if they run in parallel or plugins observe each instruction
+  // Lockstep execution reads every register as an array of lanes, so it
+  // cannot use the single shared copy of a uniform result either
+  m_skipUniform = checkEnv("OCLGRIND_SKIP_UNIFORM") && !m_parallelWorkItems &&
+                  !m_lockstepWidth;
+  if (m_context->isInstrumented() &&
+      m_context->hasEventListeners(Plugin::INSTRUCTION_EXECUTED))
+    m_skipUniform = false;
+  m_uniformSkipped = 0;
 
   // Check for quick-mode environment variable
   if (checkEnv("OCLGRIND_QUICK"))
@@ -100,11 +138,41 @@ KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
 KernelInvocation::~KernelInvocation()
 {
   // Destroy any remaining work-groups
-  while (!m_runningGroups.empty())
+  for (unsigned i = 0; i < m_numWorkers; i++)
+  {
+    list<WorkGroup*>& runningGroups = m_workers[i].runningGroups;
+    while (!runningGroups.empty())
+    {
+      delete runningGroups.front();
+      runningGroups.pop_front();
+    }
+    delete m_workers[i].spareGroup;
+  }
+  delete[] m_workers;
+}
+
+WorkGroup* KernelInvocation::createWorkGroup(size_t index, Worker& worker)
+{
+  Size3 wgid   = m_workGroups[index];
+  Size3 wgsize = m_localSize;
+
+  // Handle remainder work-groups
+  for (unsigned i = 0; i < 3; i++)
   {
-    delete m_runningGroups.front();
-    m_runningGroups.pop_front();
+    if (wgsize[i]*(wgid[i]+1) > m_globalSize[i])
+      wgsize[i] = m_globalSize[i] % wgsize[i];
   }
+
+  // Reuse this worker's last completed work-group if there is one
+  WorkGroup *workGroup = worker.spareGroup;
+  if (workGroup)
+  {
+    worker.spareGroup = NULL;
+    workGroup->reset(wgid, wgsize);
+    return workGroup;
+  }
+
+  return new WorkGroup(this, wgid, wgsize);
 }
 
 const Context* KernelInvocation::getContext() const
@@ -122,6 +190,45 @@ const WorkItem* KernelInvocation::getCurrentWorkItem() const
   return workerState.workItem;
 }
 
+bool KernelInvocation::getNextGroup(unsigned index, size_t& group)
+{
+  // Take the next work-group from our own range
+  Worker& worker = m_workers[index];
+  {
+    lock_guard<mutex> lock(worker.mutex);
+    if (worker.nextGroup < worker.endGroup)
+    {
+      group = worker.nextGroup++;
+      return true;
+    }
+  }
+
+  // Steal the upper half of another worker's remaining range
+  for (unsigned i = 1; i < m_numWorkers; i++)
+  {
+    Worker& victim = m_workers[(index + i) % m_numWorkers];
+    size_t begin, end;
+    {
+      lock_guard<mutex> lock(victim.mutex);
+      size_t remaining = victim.endGroup - victim.nextGroup;
+      if (!remaining)
+        continue;
+
+      end   = victim.endGroup;
+      begin = end - (remaining+1)/2;
+      victim.endGroup = begin;
+    }
+
+    lock_guard<mutex> lock(worker.mutex);
+    worker.nextGroup = begin + 1;
+    worker.endGroup  = end;
+    group = begin;
+    return true;
+  }
+
+  return false;
+}
+
 Size3 KernelInvocation::getGlobalOffset() const
 {
   return m_globalOffset;
@@ -172,27 +279,215 @@ void KernelInvocation::run(const Context *context, Kernel *kernel,
   delete ki;
 }
 
+void KernelInvocation::releaseWorkGroup(WorkGroup *workGroup, Worker& worker)
+{
+  m_uniformSkipped += workGroup->getUniformSkipped();
+
+  if (worker.spareGroup)
+    delete worker.spareGroup;
+  worker.spareGroup = workGroup;
+}
+
 void KernelInvocation::run()
 {
-  nextGroupIndex = 0;
+  if (m_parallelWorkItems)
+  {
+    runParallelWorkItems();
+  }
+  else
+  {
+    // Give each worker a contiguous range of work-groups
+    size_t numGroups = m_workGroups.size();
+    for (unsigned i = 0; i < m_numWorkers; i++)
+    {
+      m_workers[i].nextGroup = (numGroups*i) / m_numWorkers;
+      m_workers[i].endGroup  = (numGroups*(i+1)) / m_numWorkers;
+    }
+
+    // Run workers and wait for them to complete
+    m_context->runWorkers([this](unsigned index){ runWorker(index); },
+                          m_numWorkers);
+  }
 
-  // Create worker threads
-  // TODO: Run in main thread if only 1 worker
-  vector<thread> threads;
+  // Release recycled work-groups while the kernel is still running
   for (unsigned i = 0; i < m_numWorkers; i++)
   {
-    threads.push_back(thread(&KernelInvocation::runWorker, this));
+    delete m_workers[i].spareGroup;
+    m_workers[i].spareGroup = NULL;
   }
 
-  // Wait for workers to complete
-  for (unsigned i = 0; i < m_numWorkers; i++)
+  if (m_skipUniform)
+  {
+    Context::Message msg(INFO, m_context);
+    msg << "Skipped " << dec << m_uniformSkipped.load()
+        << " executions of uniform instructions" << endl;
+    msg.send();
+  }
+
+  // Report which execution mode actually ran, on request
+  if (checkEnv("OCLGRIND_STATS") && (m_parallelWorkItems || m_lockstepWidth))
+  {
+    Context::Message msg(INFO, m_context);
+    if (m_parallelWorkItems)
+    {
+      msg << "Ran work-items in parallel across " << dec << m_numWorkers
+          << " threads" << endl;
+    }
+    if (m_lockstepWidth)
+    {
+      msg << "Ran work-items in lockstep chunks of " << dec << m_lockstepWidth
+          << endl;
+      if (m_lanesVectorised)
+      {
+        msg << "Executed " << m_lanesVectorised.load()
+            << " instructions across all active lanes at once" << endl;
+      }
+    }
+    msg.send();
+  }
+}
+
+void KernelInvocation::runLockstep(WorkGroup *workGroup)
+{
+  Size3 size = workGroup->getGroupSize();
+  size_t numWorkItems = size.x*size.y*size.z;
+  vector<WorkItem*> lanes, active;
+  size_t vectorised = 0;
+  while (true)
   {
-    threads[i].join();
+    // Run each chunk of work-items together until they all finish or
+    // reach a barrier
+    for (size_t begin = 0; begin < numWorkItems; begin += m_lockstepWidth)
+    {
+      size_t end = min(begin + m_lockstepWidth, numWorkItems);
+      lanes.clear();
+      for (size_t i = begin; i < end; i++)
+      {
+        Size3 lid(i % size.x, (i / size.x) % size.y, i / (size.x*size.y));
+        WorkItem *workItem = workGroup->getWorkItem(lid);
+        if (workItem->getState() == WorkItem::READY)
+          lanes.push_back(workItem);
+      }
+
+      while (true)
+      {
+        // Select the work-items that should execute the next instruction,
+        // leaving divergent work-items masked off until they reconverge
+        WorkItem *leader = NULL;
+        for (auto lane = lanes.begin(); lane != lanes.end(); lane++)
+        {
+          if ((*lane)->getState() == WorkItem::READY &&
+              (!leader || (*lane)->runsBefore(leader)))
+            leader = *lane;
+        }
+        if (!leader)
+          break;
+
+        active.clear();
+        for (auto lane = lanes.begin(); lane != lanes.end(); lane++)
+        {
+          if ((*lane)->getState() == WorkItem::READY &&
+              (*lane)->atSamePosition(leader))
+            active.push_back(*lane);
+        }
+
+        // Execute the instruction across all active work-items at once if
+        // possible, otherwise step them one at a time
+        workerState.workItem = active.front();
+        if (WorkItem::stepLanes(active.data(), active.size()))
+        {
+          vectorised++;
+        }
+        else
+        {
+          for (auto lane = active.begin(); lane != active.end(); lane++)
+          {
+            workerState.workItem = *lane;
+            (*lane)->step();
+          }
+        }
+      }
+    }
+    workerState.workItem = NULL;
+
+    if (!workGroup->hasBarrier())
+      break;
+    workGroup->clearBarrier();
   }
+  m_lanesVectorised += vectorised;
 }
 
-void KernelInvocation::runWorker()
+void KernelInvocation::runParallelWorkItems()
 {
+  // Work-groups run one at a time, with their work-items spread across
+  // the workers between each pair of barriers
+  for (size_t group = 0; group < m_workGroups.size(); group++)
+  {
+    WorkGroup *workGroup = createWorkGroup(group, m_workers[0]);
+    workerState.workGroup = workGroup;
+    m_context->notifyWorkGroupBegin(workGroup);
+
+    Size3 size = workGroup->getGroupSize();
+    size_t numWorkItems = size.x*size.y*size.z;
+    atomic<bool> failed(false);
+    while (true)
+    {
+      // Run every ready work-item until it finishes or reaches a barrier
+      atomic<size_t> nextWorkItem(0);
+      m_context->runWorkers([&](unsigned index)
+      {
+        workerState.workerIndex = index;
+        workerState.workGroup = workGroup;
+        try
+        {
+          size_t i;
+          while (!failed && (i = nextWorkItem++) < numWorkItems)
+          {
+            Size3 lid(i % size.x, (i / size.x) % size.y, i / (size.x*size.y));
+            workerState.workItem = workGroup->getWorkItem(lid);
+            while (workerState.workItem->getState() == WorkItem::READY)
+            {
+              if (m_singleStep)
+                workerState.workItem->step();
+              else
+                workerState.workItem->run();
+            }
+          }
+        }
+        catch (FatalError& err)
+        {
+          ostringstream info;
+          info << "OCLGRIND FATAL ERROR "
+               << "(" << err.getFile() << ":" << err.getLine() << ")"
+               << endl << err.what();
+          m_context->logError(info.str().c_str());
+          failed = true;
+        }
+        workerState.workItem = NULL;
+      }, m_numWorkers);
+
+      // Barriers are the join points between parallel sections
+      if (failed || !workGroup->hasBarrier())
+        break;
+      workGroup->clearBarrier();
+    }
+
+    workerState.workGroup = NULL;
+    if (failed)
+    {
+      delete workGroup;
+      break;
+    }
+
+    m_context->notifyWorkGroupComplete(workGroup);
+    releaseWorkGroup(workGroup, m_workers[0]);
+  }
+}
+
+void KernelInvocation::runWorker(unsigned index)
+{
+  list<WorkGroup*>& runningGroups = m_workers[index].runningGroups;
+  workerState.workerIndex = index;
   workerState.workGroup = NULL;
   workerState.workItem = NULL;
   try
@@ -200,42 +495,37 @@ void KernelInvocation::runWorker()
     while (true)
     {
       // Move to next work-group
-      if (!m_runningGroups.empty())
+      if (!runningGroups.empty())
       {
         // Take next work-group from running pool
-        workerState.workGroup = m_runningGroups.front();
-        m_runningGroups.pop_front();
+        workerState.workGroup = runningGroups.front();
+        runningGroups.pop_front();
       }
       else
       {
         // Take next work-group from pending pool
-        unsigned index = nextGroupIndex++;
-        if (index >= m_workGroups.size())
+        size_t group;
+        if (!getNextGroup(index, group))
           // No more work to do
           break;
 
-        Size3 wgid   = m_workGroups[index];
-        Size3 wgsize = m_localSize;
-
-        // Handle remainder work-groups
-        for (unsigned i = 0; i < 3; i++)
-        {
-          if (wgsize[i]*(wgid[i]+1) > m_globalSize[i])
-            wgsize[i] = m_globalSize[i] % wgsize[i];
-        }
-
-        workerState.workGroup = new WorkGroup(this, wgid, wgsize);
+        workerState.workGroup = createWorkGroup(group, m_workers[index]);
         m_context->notifyWorkGroupBegin(workerState.workGroup);
       }
 
       // Execute work-group
+      if (m_lockstepWidth)
+        runLockstep(workerState.workGroup);
       workerState.workItem = workerState.workGroup->getNextWorkItem();
       while (workerState.workItem)
       {
         // Run work-item until complete or at barrier
         while (workerState.workItem->getState() == WorkItem::READY)
         {
-          workerState.workItem->step();
+          if (m_singleStep)
+            workerState.workItem->step();
+          else
+            workerState.workItem->run();
         }
 
         // Move to next work-item
@@ -255,7 +545,7 @@ void KernelInvocation::runWorker()
 
       // Work-group has finished
       m_context->notifyWorkGroupComplete(workerState.workGroup);
-      delete workerState.workGroup;
+      releaseWorkGroup(workerState.workGroup, m_workers[index]);
       workerState.workGroup = NULL;
     }
   }
@@ -272,6 +562,11 @@ void KernelInvocation::runWorker()
   }
 }
 
+bool KernelInvocation::skipUniformValues() const
+{
+  return m_skipUniform;
+}
+
 bool KernelInvocation::switchWorkItem(const Size3 gid)
 {
   assert(m_numWorkers == 1);
@@ -281,6 +576,7 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
 
   bool found = false;
   WorkGroup *previousWorkGroup = workerState.workGroup;
+  Worker& worker = m_workers[workerState.workerIndex];
 
   // Check if we're already running the work-group
   if (group == previousWorkGroup->getGroupID())
@@ -292,12 +588,13 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
   if (!found)
   {
     std::list<WorkGroup*>::iterator rItr;
-    for (rItr = m_runningGroups.begin(); rItr != m_runningGroups.end(); rItr++)
+    for (rItr = worker.runningGroups.begin();
+         rItr != worker.runningGroups.end(); rItr++)
     {
       if (group == (*rItr)->getGroupID())
       {
         workerState.workGroup = *rItr;
-        m_runningGroups.erase(rItr);
+        worker.runningGroups.erase(rItr);
         found = true;
         break;
       }
@@ -308,8 +605,8 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
   if (!found)
   {
     std::vector<Size3>::iterator pItr;
-    for (pItr = m_workGroups.begin()+nextGroupIndex;
-         pItr != m_workGroups.end(); pItr++)
+    for (pItr = m_workGroups.begin()+worker.nextGroup;
+         pItr != m_workGroups.begin()+worker.endGroup; pItr++)
     {
      if (group == *pItr)
      {
@@ -320,8 +617,8 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
        // Re-order list of groups accordingly
        // Safe since this is not in a multi-threaded context
        m_workGroups.erase(pItr);
-       m_workGroups.insert(m_workGroups.begin()+nextGroupIndex, group);
-       nextGroupIndex++;
+       m_workGroups.insert(m_workGroups.begin()+worker.nextGroup, group);
+       worker.nextGroup++;
 
        break;
      }
@@ -335,12 +632,21 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
 
   if (previousWorkGroup != workerState.workGroup)
   {
-    m_runningGroups.push_back(previousWorkGroup);
+    worker.runningGroups.push_back(previousWorkGroup);
   }
 
+  // Stop running the current work-item
+  if (workerState.workItem)
+    workerState.workItem->yield();
+
   // Get work-item
   Size3 lid(gid.x%m_localSize.x, gid.y%m_localSize.y, gid.z%m_localSize.z);
   workerState.workItem = workerState.workGroup->getWorkItem(lid);
 
   return true;
 }
+
+bool KernelInvocation::useGroupRegisters() const
+{
+  return m_groupRegisters;
+}
@@ -8,6 +8,9 @@
 
 #include "common.h"
 
+#include <atomic>
+#include <mutex>
+
 namespace oclgrind
 {
   class Context;
@@ -33,7 +36,9 @@ namespace oclgrind
     const Kernel* getKernel() const;
     Size3 getNumGroups() const;
     size_t getWorkDim() const;
+    bool skipUniformValues() const;
     bool switchWorkItem(const Size3 gid);
+    bool useGroupRegisters() const;
 
   private:
     KernelInvocation(const Context *context, const Kernel *kernel,
@@ -54,11 +59,36 @@ namespace oclgrind
     Size3  m_numGroups;
 
     // Current execution state
-    std::vector<Size3>    m_workGroups;
-    std::list<WorkGroup*> m_runningGroups;
+    std::vector<Size3> m_workGroups;
 
     // Worker threads
-    void runWorker();
+    struct Worker
+    {
+      // Contiguous range of pending work-groups owned by this worker
+      std::mutex mutex;
+      size_t nextGroup;
+      size_t endGroup;
+
+      // Work-groups that this worker has started but not completed
+      std::list<WorkGroup*> runningGroups;
+
+      // Completed work-group kept for reuse by this worker
+      WorkGroup *spareGroup;
+    };
+    Worker *m_workers;
     unsigned m_numWorkers;
+    bool m_groupRegisters;
+    size_t m_lockstepWidth;
+    bool m_parallelWorkItems;
+    bool m_singleStep;
+    bool m_skipUniform;
+    std::atomic<size_t> m_uniformSkipped;
+    std::atomic<size_t> m_lanesVectorised;
+    WorkGroup* createWorkGroup(size_t index, Worker& worker);
+    bool getNextGroup(unsigned index, size_t& group);
+    void releaseWorkGroup(WorkGroup *workGroup, Worker& worker);
+    void runLockstep(WorkGroup *workGroup);
+    void runParallelWorkItems();
+    void runWorker(unsigned index);
   };
 }
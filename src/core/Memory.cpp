@@ -91,16 +91,27 @@ size_t Memory::allocateBuffer(size_t size, cl_mem_flags flags,
   return address;
 }
 
-template uint64_t Memory::atomic(AtomicOp op, size_t address, uint64_t value);
-template int64_t Memory::atomic(AtomicOp op, size_t address, int64_t value);
-template uint32_t Memory::atomic(AtomicOp op, size_t address, uint32_t value);
-template int32_t Memory::atomic(AtomicOp op, size_t address, int32_t value);
-
-template<typename T>
+#define ATOMIC_INSTANTIATION(T, instrumented) \
+  template T Memory::atomic<T, instrumented>(AtomicOp op, size_t address, \
+                                             T value);
+ATOMIC_INSTANTIATION(uint64_t, true)
+ATOMIC_INSTANTIATION(int64_t, true)
+ATOMIC_INSTANTIATION(uint32_t, true)
+ATOMIC_INSTANTIATION(int32_t, true)
+ATOMIC_INSTANTIATION(uint64_t, false)
+ATOMIC_INSTANTIATION(int64_t, false)
+ATOMIC_INSTANTIATION(uint32_t, false)
+ATOMIC_INSTANTIATION(int32_t, false)
+#undef ATOMIC_INSTANTIATION
+
+template<typename T, bool instrumented>
 T Memory::atomic(AtomicOp op, size_t address, T value)
 {
-  m_context->notifyMemoryAtomicLoad(this, op, address, sizeof(T));
-  m_context->notifyMemoryAtomicStore(this, op, address, sizeof(T));
+  if (instrumented)
+  {
+    m_context->notifyMemoryAtomicLoad(this, op, address, sizeof(T));
+    m_context->notifyMemoryAtomicStore(this, op, address, sizeof(T));
+  }
 
   // Bounds check
   if (!isAddressValid(address, sizeof(T)))
@@ -113,7 +124,7 @@ T Memory::atomic(AtomicOp op, size_t address, T value)
   Buffer *buffer = m_memory[extractBuffer(address)];
   T *ptr = (T*)(buffer->data + offset);
 
-  if (m_addressSpace == AddrSpaceGlobal)
+  if (m_addressSpace != AddrSpacePrivate)
     ATOMIC_MUTEX(offset).lock();
 
   T old = *ptr;
@@ -154,19 +165,26 @@ T Memory::atomic(AtomicOp op, size_t address, T value)
     break;
   }
 
-  if (m_addressSpace == AddrSpaceGlobal)
+  if (m_addressSpace != AddrSpacePrivate)
     ATOMIC_MUTEX(offset).unlock();
 
   return old;
 }
 
-template uint32_t Memory::atomicCmpxchg(size_t address, uint32_t cmp, uint32_t value);
-template uint64_t Memory::atomicCmpxchg(size_t address, uint64_t cmp, uint64_t value);
+#define ATOMIC_CMPXCHG_INSTANTIATION(T, instrumented) \
+  template T Memory::atomicCmpxchg<T, instrumented>(size_t address, \
+                                                    T cmp, T value);
+ATOMIC_CMPXCHG_INSTANTIATION(uint32_t, true)
+ATOMIC_CMPXCHG_INSTANTIATION(uint64_t, true)
+ATOMIC_CMPXCHG_INSTANTIATION(uint32_t, false)
+ATOMIC_CMPXCHG_INSTANTIATION(uint64_t, false)
+#undef ATOMIC_CMPXCHG_INSTANTIATION
 
-template<typename T>
+template<typename T, bool instrumented>
 T Memory::atomicCmpxchg(size_t address, T cmp, T value)
 {
-  m_context->notifyMemoryAtomicLoad(this, AtomicCmpXchg, address, sizeof(T));
+  if (instrumented)
+    m_context->notifyMemoryAtomicLoad(this, AtomicCmpXchg, address, sizeof(T));
 
   // Bounds check
   if (!isAddressValid(address, sizeof(T)))
@@ -179,7 +197,7 @@ T Memory::atomicCmpxchg(size_t address, T cmp, T value)
   Buffer *buffer = m_memory[extractBuffer(address)];
   T *ptr = (T *)(buffer->data + offset);
 
-  if (m_addressSpace == AddrSpaceGlobal)
+  if (m_addressSpace != AddrSpacePrivate)
     ATOMIC_MUTEX(offset).lock();
 
   // Perform cmpxchg
@@ -188,10 +206,12 @@ T Memory::atomicCmpxchg(size_t address, T cmp, T value)
   {
     *ptr = value;
 
-    m_context->notifyMemoryAtomicStore(this, AtomicCmpXchg, address, sizeof(T));
+    if (instrumented)
+      m_context->notifyMemoryAtomicStore(this, AtomicCmpXchg,
+                                         address, sizeof(T));
   }
 
-  if (m_addressSpace == AddrSpaceGlobal)
+  if (m_addressSpace != AddrSpacePrivate)
     ATOMIC_MUTEX(offset).unlock();
 
   return old;
@@ -411,9 +431,16 @@ bool Memory::isAddressValid(size_t address, size_t size) const
   return true;
 }
 
+template bool Memory::load<true>(unsigned char *dest,
+                                 size_t address, size_t size) const;
+template bool Memory::load<false>(unsigned char *dest,
+                                  size_t address, size_t size) const;
+
+template<bool instrumented>
 bool Memory::load(unsigned char *dest, size_t address, size_t size) const
 {
-  m_context->notifyMemoryLoad(this, address, size);
+  if (instrumented)
+    m_context->notifyMemoryLoad(this, address, size);
 
   // Bounds check
   if (!isAddressValid(address, size))
@@ -444,9 +471,16 @@ void* Memory::mapBuffer(size_t address, size_t offset, size_t size)
   return m_memory[buffer]->data + offset + extractOffset(address);
 }
 
+template bool Memory::store<true>(const unsigned char *source,
+                                  size_t address, size_t size);
+template bool Memory::store<false>(const unsigned char *source,
+                                   size_t address, size_t size);
+
+template<bool instrumented>
 bool Memory::store(const unsigned char *source, size_t address, size_t size)
 {
-  m_context->notifyMemoryStore(this, address, size, source);
+  if (instrumented)
+    m_context->notifyMemoryStore(this, address, size, source);
 
   // Bounds check
   if (!isAddressValid(address, size))
@@ -28,8 +28,10 @@ namespace oclgrind
 
     size_t allocateBuffer(size_t size, cl_mem_flags flags=0,
                           const uint8_t *initData = NULL);
-    template<typename T> T atomic(AtomicOp op, size_t address, T value = 0);
-    template<typename T> T atomicCmpxchg(size_t address, T cmp, T value);
+    template<typename T, bool instrumented = true>
+    T atomic(AtomicOp op, size_t address, T value = 0);
+    template<typename T, bool instrumented = true>
+    T atomicCmpxchg(size_t address, T cmp, T value);
     void clear();
     size_t createHostBuffer(size_t size, void *ptr, cl_mem_flags flags=0);
     bool copy(size_t dest, size_t src, size_t size);
@@ -40,8 +42,10 @@ namespace oclgrind
     void* getPointer(size_t address) const;
     size_t getTotalAllocated() const;
     bool isAddressValid(size_t address, size_t size=1) const;
+    template<bool instrumented = true>
     bool load(unsigned char *dst, size_t address, size_t size=1) const;
     void* mapBuffer(size_t address, size_t offset, size_t size);
+    template<bool instrumented = true>
     bool store(const unsigned char *source, size_t address, size_t size=1);
 
     size_t extractBuffer(size_t address) const;
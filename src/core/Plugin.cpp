@@ -19,7 +19,17 @@ Plugin::~Plugin()
 {
 }
 
+unsigned Plugin::getEventMask() const
+{
+  return ALL_EVENTS;
+}
+
 bool Plugin::isThreadSafe() const
 {
   return true;
 }
+
+bool Plugin::supportsParallelWorkItems() const
+{
+  return false;
+}
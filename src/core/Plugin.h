@@ -21,6 +21,33 @@ namespace oclgrind
 
   class Plugin
   {
+  public:
+    // Events that a plugin can subscribe to
+    enum Event
+    {
+      HOST_MEMORY_LOAD     = 1 << 0,
+      HOST_MEMORY_STORE    = 1 << 1,
+      INSTRUCTION_EXECUTED = 1 << 2,
+      KERNEL_BEGIN         = 1 << 3,
+      KERNEL_END           = 1 << 4,
+      LOG                  = 1 << 5,
+      MEMORY_ALLOCATED     = 1 << 6,
+      MEMORY_ATOMIC_LOAD   = 1 << 7,
+      MEMORY_ATOMIC_STORE  = 1 << 8,
+      MEMORY_DEALLOCATED   = 1 << 9,
+      MEMORY_LOAD          = 1 << 10,
+      MEMORY_MAP           = 1 << 11,
+      MEMORY_STORE         = 1 << 12,
+      MEMORY_UNMAP         = 1 << 13,
+      WORK_GROUP_BARRIER   = 1 << 14,
+      WORK_GROUP_BEGIN     = 1 << 15,
+      WORK_GROUP_COMPLETE  = 1 << 16,
+      WORK_ITEM_BEGIN      = 1 << 17,
+      WORK_ITEM_COMPLETE   = 1 << 18,
+    };
+    static const unsigned NUM_EVENTS = 19;
+    static const unsigned ALL_EVENTS = (1 << NUM_EVENTS) - 1;
+
   public:
     Plugin(const Context *context);
     virtual ~Plugin();
@@ -66,8 +93,14 @@ namespace oclgrind
     virtual void workItemBegin(const WorkItem *workItem){}
     virtual void workItemComplete(const WorkItem *workItem){}
 
+    // Returns a bitmask of the events that this plugin handles
+    virtual unsigned getEventMask() const;
+
     virtual bool isThreadSafe() const;
 
+    // Whether work-items from one work-group may run on different threads
+    virtual bool supportsParallelWorkItems() const;
+
   protected:
     const Context *m_context;
   };
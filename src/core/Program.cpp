@@ -9,7 +9,10 @@
 #include "config.h"
 #include "common.h"
 
+#include <atomic>
 #include <fstream>
+#include <iterator>
+#include <mutex>
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include <windows.h>
@@ -31,11 +34,19 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "clang/Basic/Version.h"
 #include "clang/CodeGen/CodeGenAction.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Frontend/Utils.h"
 #include "clang/Lex/PreprocessorOptions.h"
 
 #include "Context.h"
@@ -59,6 +70,21 @@
 #define OPENCL_C_H_PATH REMAP_DIR"opencl-c.h"
 extern const char OPENCL_C_H_DATA[];
 
+// Program binaries hold a header, the build options and the module bitcode
+#define BINARY_MAGIC "OCLGRIND"
+#define BINARY_VERSION 1
+#define BINARY_UNIFORM_WORK_GROUPS 0x1
+
+struct BinaryHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t pointerSize;
+  uint32_t flags;
+  uint32_t optionsSize;
+  uint64_t bitcodeSize;
+};
+
 const char *EXTENSIONS[] =
 {
   "cl_khr_fp64",
@@ -75,12 +101,64 @@ const char *EXTENSIONS[] =
 using namespace oclgrind;
 using namespace std;
 
+// Guards the process-wide LLVM pass timers
+static mutex passTimingMutex;
+
+// Records the time spent in each phase of a program build
+class BuildTimer
+{
+public:
+  BuildTimer(bool enabled) : m_enabled(enabled), m_last(now()) {}
+
+  // Attribute time since the previous phase ended to this phase
+  void endPhase(const char *name)
+  {
+    if (!m_enabled)
+      return;
+    double t = now();
+    m_phases.push_back(make_pair(name, t - m_last));
+    m_last = t;
+  }
+
+  void report(const string& pipeline) const
+  {
+    if (!m_enabled)
+      return;
+
+    ios_base::fmtflags flags = cerr.flags();
+    streamsize precision = cerr.precision();
+
+    double total = 0;
+    cerr << "Oclgrind: Build time report (pipeline: " << pipeline << ")"
+         << endl;
+    for (auto& phase : m_phases)
+    {
+      cerr << "  " << left << setw(36) << phase.first << right
+           << fixed << setprecision(3) << setw(10) << phase.second*1e-6
+           << " ms" << endl;
+      total += phase.second;
+    }
+    cerr << "  " << left << setw(36) << "Total" << right
+         << fixed << setprecision(3) << setw(10) << total*1e-6
+         << " ms" << endl;
+
+    cerr.flags(flags);
+    cerr.precision(precision);
+  }
+
+private:
+  bool m_enabled;
+  double m_last;
+  vector< pair<const char*, double> > m_phases;
+};
+
 Program::Program(const Context *context, llvm::Module *module)
   : m_module(module), m_context(context)
 {
   m_buildLog = "";
   m_buildOptions = "";
   m_buildStatus = CL_BUILD_SUCCESS;
+  m_requiresUniformWorkGroups = false;
   m_uid = generateUID();
   m_totalProgramScopeVarSize = 0;
 
@@ -94,6 +172,7 @@ Program::Program(const Context *context, const string& source)
   m_buildLog = "";
   m_buildOptions = "";
   m_buildStatus = CL_BUILD_NONE;
+  m_requiresUniformWorkGroups = false;
   m_uid = 0;
   m_totalProgramScopeVarSize = 0;
 
@@ -114,10 +193,14 @@ Program::~Program()
 {
   clearInterpreterCache();
   deallocateProgramScopeVars();
+
+  lock_guard<mutex> lock(m_context->getLLVMContextMutex());
+  m_module.reset();
 }
 
 void Program::allocateProgramScopeVars()
 {
+  lock_guard<recursive_mutex> lock(m_context->getGlobalMemoryMutex());
   deallocateProgramScopeVars();
 
   Memory *globalMemory = m_context->getGlobalMemory();
@@ -236,6 +319,9 @@ bool Program::build(const char *options, list<Header> headers)
   m_buildStatus = CL_BUILD_IN_PROGRESS;
   m_buildOptions = options ? options : "";
 
+  bool timePasses = checkEnv("OCLGRIND_TIME_PASSES");
+  BuildTimer timer(timePasses);
+
   // Create build log
   m_buildLog = "";
   llvm::raw_string_ostream buildLog(m_buildLog);
@@ -253,7 +339,9 @@ bool Program::build(const char *options, list<Header> headers)
   if (m_module)
   {
     clearInterpreterCache();
+    lock_guard<mutex> lock(m_context->getLLVMContextMutex());
     m_module.reset();
+    m_bitcode.clear();
   }
 
   // Assign a new UID to this program
@@ -305,9 +393,43 @@ bool Program::build(const char *options, list<Header> headers)
   m_requiresUniformWorkGroups = false;
 
   // Disable optimizations by default if in interactive mode
-  if (checkEnv("OCLGRIND_INTERACTIVE"))
+  bool keepDebugInfo = checkEnv("OCLGRIND_INTERACTIVE");
+  if (keepDebugInfo)
     optimize = false;
 
+  // Select optimization pipeline preset
+  unsigned optLevel = 2;
+  unsigned sizeLevel = 2;
+  bool inlining = false;
+  const char *preset = getenv("OCLGRIND_OPT_PIPELINE");
+  if (preset && strcmp(preset, "default"))
+  {
+    if (!strcmp(preset, "compile"))
+    {
+      // Cheap cleanup passes only
+      optimize = true;
+      optLevel = 1;
+      sizeLevel = 0;
+    }
+    else if (!strcmp(preset, "run"))
+    {
+      // Minimize the number of instructions executed
+      optimize = true;
+      optLevel = 3;
+      sizeLevel = 0;
+      inlining = true;
+    }
+    else if (!strcmp(preset, "debug"))
+    {
+      optimize = false;
+      keepDebugInfo = true;
+    }
+    else
+    {
+      cerr << "Oclgrind: Invalid value for OCLGRIND_OPT_PIPELINE" << endl;
+    }
+  }
+
   // Add OpenCL build options
   const char *mainOptions = options;
   const char *extraOptions = getenv("OCLGRIND_BUILD_OPTIONS");
@@ -372,12 +494,30 @@ bool Program::build(const char *options, list<Header> headers)
   {
     clstd = "-cl-std=CL1.2";
   }
+
+  // Describe pipeline for cache keys and timing reports
+  char pipeline[32];
+  if (optimize)
+    sprintf(pipeline, "-O%u -s%u%s", optLevel, sizeLevel,
+            inlining ? " -inline" : "");
+  else
+    sprintf(pipeline, "-O0");
+  if (keepDebugInfo)
+    strcat(pipeline, " -g");
+
+  // Rewrite IR into forms that are cheaper to interpret, unless debugging
+  bool canonicalize =
+    !keepDebugInfo && !checkEnv("OCLGRIND_DISABLE_CANONICALIZATION");
+  if (canonicalize)
+    strcat(pipeline, " -canon");
   args.push_back(clstd);
 
   // If compiling for OpenCL 1.X, require uniform work-groups
   if (strncmp(clstd, "-cl-std=CL1.", 12) == 0)
     m_requiresUniformWorkGroups = true;
 
+  timer.endPhase("Option processing");
+
   // Pre-compiled header
   char *pchdir = NULL;
   char *pch    = NULL;
@@ -468,90 +608,204 @@ bool Program::build(const char *options, list<Header> headers)
   // Append input file to arguments (remapped later)
   args.push_back(REMAP_INPUT);
 
-  // Create diagnostics engine
-  clang::DiagnosticOptions *diagOpts = new clang::DiagnosticOptions();
-  llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> diagID(
-    new clang::DiagnosticIDs());
-  clang::TextDiagnosticPrinter *diagConsumer =
-    new clang::TextDiagnosticPrinter(buildLog, diagOpts);
-  clang::DiagnosticsEngine diags(diagID, diagOpts, diagConsumer);
+  timer.endPhase("Precompiled header lookup");
 
-  // Create compiler instance
-  clang::CompilerInstance compiler;
-  compiler.createDiagnostics(diagConsumer, false);
+  // Check for a compiled copy of this program in the in-process cache,
+  // followed by the on-disk cache
+  string key = getCacheKey(args, headers, pipeline);
+  string cachePath;
+  const char *cacheDir = getenv("OCLGRIND_CACHE_DIR");
+  if (cacheDir && strlen(cacheDir))
+  {
+    cachePath = string(cacheDir) + "/" + key;
+  }
+
+  buildLog.flush();
+  string bitcode;
+  bool cached = loadFromBuildCache(key, bitcode);
+  bool onDisk = false;
+  if (!cached && !cachePath.empty())
+  {
+    cached = onDisk = loadFromCache(cachePath, bitcode);
+    if (cached)
+      storeInBuildCache(key, bitcode);
+  }
+  m_context->recordProgramCacheLookup(cached, onDisk);
+  timer.endPhase("Cache lookup");
 
-  // Create compiler invocation
+  if (!cached)
+  {
+    // Compile into a private LLVM context, so that programs belonging to
+    // the same context can be built concurrently
+    llvm::LLVMContext buildContext;
+
+    // Create diagnostics engine
+    clang::DiagnosticOptions *diagOpts = new clang::DiagnosticOptions();
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> diagID(
+      new clang::DiagnosticIDs());
+    clang::TextDiagnosticPrinter *diagConsumer =
+      new clang::TextDiagnosticPrinter(buildLog, diagOpts);
+    clang::DiagnosticsEngine diags(diagID, diagOpts, diagConsumer);
+
+    // Create compiler instance
+    clang::CompilerInstance compiler;
+    compiler.createDiagnostics(diagConsumer, false);
+
+    // Create compiler invocation
 #if LLVM_VERSION < 40
-  clang::CompilerInvocation *invocation = new clang::CompilerInvocation;
+    clang::CompilerInvocation *invocation = new clang::CompilerInvocation;
 #else
-  std::shared_ptr<clang::CompilerInvocation> invocation(
-      new clang::CompilerInvocation);
+    std::shared_ptr<clang::CompilerInvocation> invocation(
+        new clang::CompilerInvocation);
 #endif
-  clang::CompilerInvocation::CreateFromArgs(*invocation,
-                                            &args[0], &args[0] + args.size(),
-                                            compiler.getDiagnostics());
-  compiler.setInvocation(invocation);
-
-  // Remap include files
-  std::unique_ptr<llvm::MemoryBuffer> buffer;
-  compiler.getHeaderSearchOpts().AddPath(REMAP_DIR, clang::frontend::Quoted,
-                                         false, true);
-  list<Header>::iterator itr;
-  for (itr = headers.begin(); itr != headers.end(); itr++)
-  {
-    buffer = llvm::MemoryBuffer::getMemBuffer(itr->second->m_source, "", false);
-    compiler.getPreprocessorOpts().addRemappedFile(REMAP_DIR + itr->first,
+    clang::CompilerInvocation::CreateFromArgs(*invocation,
+                                              &args[0], &args[0] + args.size(),
+                                              compiler.getDiagnostics());
+    compiler.setInvocation(invocation);
+
+    // Remap include files
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    compiler.getHeaderSearchOpts().AddPath(REMAP_DIR, clang::frontend::Quoted,
+                                           false, true);
+    list<Header>::iterator itr;
+    for (itr = headers.begin(); itr != headers.end(); itr++)
+    {
+      buffer = llvm::MemoryBuffer::getMemBuffer(itr->second->m_source, "",
+                                                false);
+      compiler.getPreprocessorOpts().addRemappedFile(REMAP_DIR + itr->first,
+                                                     buffer.release());
+    }
+
+    // Remap opencl-c.h
+    buffer = llvm::MemoryBuffer::getMemBuffer(OPENCL_C_H_DATA, "", false);
+    compiler.getPreprocessorOpts().addRemappedFile(
+      OPENCL_C_H_PATH, buffer.release());
+
+    // Remap input file
+    buffer = llvm::MemoryBuffer::getMemBuffer(m_source, "", false);
+    compiler.getPreprocessorOpts().addRemappedFile(REMAP_INPUT,
                                                    buffer.release());
-  }
 
-  // Remap opencl-c.h
-  buffer = llvm::MemoryBuffer::getMemBuffer(OPENCL_C_H_DATA, "", false);
-  compiler.getPreprocessorOpts().addRemappedFile(
-    OPENCL_C_H_PATH, buffer.release());
+    // Record the files that are included, since the cache key only covers
+    // the sources of the program and its headers
+    std::shared_ptr<clang::DependencyCollector> dependencies =
+      std::make_shared<clang::DependencyCollector>();
+    compiler.addDependencyCollector(dependencies);
+
+    // Compile
+    clang::EmitLLVMOnlyAction action(&buildContext);
+    bool success = compiler.ExecuteAction(action);
+    timer.endPhase("Clang frontend (including PCH load)");
+    if (success)
+    {
+      // Retrieve module
+      m_module = action.takeModule();
 
-  // Remap input file
-  buffer = llvm::MemoryBuffer::getMemBuffer(m_source, "", false);
-  compiler.getPreprocessorOpts().addRemappedFile(REMAP_INPUT, buffer.release());
+      // Strip debug intrinsics unless debugging
+      if (!keepDebugInfo)
+      {
+        stripDebugIntrinsics();
+        timer.endPhase("stripDebugIntrinsics");
+      }
 
-  // Compile
-  clang::EmitLLVMOnlyAction action(m_context->getLLVMContext());
-  if (compiler.ExecuteAction(action))
-  {
-    // Retrieve module
-    m_module = action.takeModule();
+      // Run optimizations on module
+      if (optimize)
+      {
+        // Report time taken by each pass
+        // Pass timers are process-wide, so timed builds run one at a time
+        unique_lock<mutex> passTimingLock(passTimingMutex, defer_lock);
+        if (timePasses)
+        {
+          passTimingLock.lock();
+          llvm::TimePassesIsEnabled = true;
+        }
 
-    // Strip debug intrinsics if not in interactive mode
-    if (!checkEnv("OCLGRIND_INTERACTIVE"))
-    {
-      stripDebugIntrinsics();
-    }
+        // Initialize pass managers
+        llvm::legacy::PassManager modulePasses;
+        llvm::legacy::FunctionPassManager functionPasses(m_module.get());
 
-    // Run optimizations on module
-    if (optimize)
-    {
-      // Initialize pass managers
-      llvm::legacy::PassManager modulePasses;
-      llvm::legacy::FunctionPassManager functionPasses(m_module.get());
-
-      // Populate pass managers with -Oz
-      llvm::PassManagerBuilder builder;
-      builder.OptLevel = 2;
-      builder.SizeLevel = 2;
-      builder.populateModulePassManager(modulePasses);
-      builder.populateFunctionPassManager(functionPasses);
-
-      // Run passes
-      functionPasses.doInitialization();
-      llvm::Module::iterator fItr;
-      for (fItr = m_module->begin(); fItr != m_module->end(); fItr++)
-        functionPasses.run(*fItr);
-      functionPasses.doFinalization();
-      modulePasses.run(*m_module);
+        // Populate pass managers with selected pipeline
+        llvm::PassManagerBuilder builder;
+        builder.OptLevel = optLevel;
+        builder.SizeLevel = sizeLevel;
+        if (inlining)
+        {
+#if LLVM_VERSION < 50
+          builder.Inliner = llvm::createFunctionInliningPass(optLevel,
+                                                             sizeLevel);
+#else
+          builder.Inliner = llvm::createFunctionInliningPass(optLevel,
+                                                             sizeLevel,
+                                                             false);
+#endif
+        }
+        builder.populateModulePassManager(modulePasses);
+        builder.populateFunctionPassManager(functionPasses);
+
+        // Run passes
+        functionPasses.doInitialization();
+        llvm::Module::iterator fItr;
+        for (fItr = m_module->begin(); fItr != m_module->end(); fItr++)
+          functionPasses.run(*fItr);
+        functionPasses.doFinalization();
+        modulePasses.run(*m_module);
+        timer.endPhase("Optimization passes");
+
+        if (timePasses)
+        {
+          llvm::TimerGroup::printAll(llvm::errs());
+          llvm::TimePassesIsEnabled = false;
+        }
+      }
+
+      removeLValueLoads();
+      timer.endPhase("removeLValueLoads");
+
+      if (canonicalize)
+      {
+        canonicalizeForInterpreter();
+        timer.endPhase("canonicalizeForInterpreter");
+      }
+
+      // Serialize module for import into the shared context
+      {
+        llvm::raw_string_ostream stream(bitcode);
+        llvm::WriteBitcodeToFile(m_module.get(), stream);
+      }
+      m_module.reset();
+
+      // Programs that include files from disk are not cached, since a
+      // cached copy would not be rebuilt when those files change
+      bool readsFiles = false;
+      for (const std::string& file : dependencies->getDependencies())
+      {
+        if (file == REMAP_INPUT || !file.compare(0, strlen(REMAP_DIR),
+                                                 REMAP_DIR))
+          continue;
+        if ((pch && file == pch) ||
+            (pchdir && !file.compare(0, strlen(pchdir), pchdir)))
+          continue;
+        readsFiles = true;
+      }
+
+      buildLog.flush();
+      if (!readsFiles)
+      {
+        storeInBuildCache(key, bitcode);
+        if (!cachePath.empty())
+          storeInCache(cachePath, bitcode);
+      }
+      timer.endPhase("Cache store");
     }
+  }
 
-    removeLValueLoads();
+  if (!bitcode.empty() && parseBitcode(bitcode))
+  {
+    m_bitcode = std::move(bitcode);
+    timer.endPhase("Bitcode import");
 
     allocateProgramScopeVars();
+    timer.endPhase("allocateProgramScopeVars");
 
     m_buildStatus = CL_BUILD_SUCCESS;
   }
@@ -609,9 +863,251 @@ bool Program::build(const char *options, list<Header> headers)
   delete[] pchdir;
   delete[] pch;
 
+  timer.report(pipeline);
+
   return m_buildStatus == CL_BUILD_SUCCESS;
 }
 
+string Program::getCacheKey(const vector<const char*>& args,
+                            const list<Header>& headers,
+                            const char *pipeline) const
+{
+  llvm::MD5 hash;
+
+  // Anything that could change the generated module must be included here
+  hash.update(PACKAGE_VERSION);
+  hash.update(llvm::StringRef("\0", 1));
+  hash.update(clang::getClangFullVersion());
+  hash.update(llvm::StringRef("\0", 1));
+  char config[64];
+  sprintf(config, "%d %d %s", LLVM_VERSION, (int)sizeof(size_t), pipeline);
+  hash.update(config);
+  hash.update(llvm::StringRef("\0", 1));
+
+  for (unsigned i = 0; i < args.size(); i++)
+  {
+    hash.update(args[i]);
+    hash.update(llvm::StringRef("\0", 1));
+  }
+
+  list<Header>::const_iterator itr;
+  for (itr = headers.begin(); itr != headers.end(); itr++)
+  {
+    hash.update(itr->first);
+    hash.update(llvm::StringRef("\0", 1));
+    hash.update(itr->second->m_source);
+    hash.update(llvm::StringRef("\0", 1));
+  }
+
+  hash.update(m_source);
+
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> key;
+  llvm::MD5::stringifyResult(result, key);
+  return key.str().str();
+}
+
+// Process-wide cache of built programs, shared by all contexts. Modules
+// cannot be shared between LLVM contexts, so entries hold the bitcode and
+// build log, and are parsed into the requesting context on a hit.
+struct Program::BuildCache
+{
+  struct Entry
+  {
+    std::string key;
+    std::string bitcode;
+    std::string log;
+  };
+  typedef std::list<Entry> EntryList;
+
+  std::mutex mutex;
+  EntryList entries; // most recently used first
+  std::unordered_map<std::string, EntryList::iterator> index;
+  size_t capacity;
+  BuildCacheStats stats;
+
+  BuildCache()
+  {
+    // Memory bound in megabytes (0 disables the cache)
+    capacity = 64;
+    const char *size = getenv("OCLGRIND_BUILD_CACHE_SIZE");
+    if (size)
+    {
+      char *next;
+      capacity = strtoul(size, &next, 10);
+      if (strlen(next))
+      {
+        cerr << "Oclgrind: Invalid value for OCLGRIND_BUILD_CACHE_SIZE"
+             << endl;
+      }
+    }
+    capacity *= 1024*1024;
+
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+    stats.entries = 0;
+    stats.bytes = 0;
+  }
+
+  static BuildCache& get()
+  {
+    static BuildCache cache;
+    return cache;
+  }
+};
+
+Program::BuildCacheStats Program::getBuildCacheStats()
+{
+  BuildCache& cache = BuildCache::get();
+  lock_guard<mutex> lock(cache.mutex);
+  return cache.stats;
+}
+
+bool Program::loadFromBuildCache(const string& key, string& bitcode)
+{
+  BuildCache& cache = BuildCache::get();
+  if (!cache.capacity)
+    return false;
+
+  lock_guard<mutex> lock(cache.mutex);
+  auto itr = cache.index.find(key);
+  if (itr == cache.index.end())
+  {
+    cache.stats.misses++;
+    return false;
+  }
+
+  // Move entry to front of LRU list
+  cache.entries.splice(cache.entries.begin(), cache.entries, itr->second);
+  bitcode = itr->second->bitcode;
+  m_buildLog = itr->second->log;
+  cache.stats.hits++;
+  return true;
+}
+
+void Program::storeInBuildCache(const string& key,
+                                const string& bitcode) const
+{
+  BuildCache& cache = BuildCache::get();
+  if (!cache.capacity)
+    return;
+
+  BuildCache::Entry entry;
+  entry.key = key;
+  entry.bitcode = bitcode;
+  entry.log = m_buildLog;
+
+  size_t size = entry.bitcode.size() + entry.log.size();
+  if (size > cache.capacity)
+    return;
+
+  lock_guard<mutex> lock(cache.mutex);
+  if (cache.index.count(key))
+    return;
+
+  // Evict least recently used entries until the new entry fits
+  while (cache.stats.bytes + size > cache.capacity)
+  {
+    BuildCache::Entry& last = cache.entries.back();
+    cache.stats.bytes -= last.bitcode.size() + last.log.size();
+    cache.stats.entries--;
+    cache.stats.evictions++;
+    cache.index.erase(last.key);
+    cache.entries.pop_back();
+  }
+
+  cache.entries.push_front(std::move(entry));
+  cache.index[key] = cache.entries.begin();
+  cache.stats.bytes += size;
+  cache.stats.entries++;
+}
+
+bool Program::parseBitcode(const string& bitcode)
+{
+  // The LLVM context is shared by all programs in this context
+  lock_guard<mutex> lock(m_context->getLLVMContextMutex());
+
+#if LLVM_VERSION < 40
+  llvm::ErrorOr<unique_ptr<llvm::Module>> module =
+#else
+  llvm::Expected<unique_ptr<llvm::Module>> module =
+#endif
+    parseBitcodeFile(llvm::MemoryBufferRef(bitcode, REMAP_INPUT),
+                     *m_context->getLLVMContext());
+  if (!module)
+  {
+    return false;
+  }
+
+  m_module = std::move(module.get());
+  return true;
+}
+
+bool Program::loadFromCache(const string& path, string& bitcode)
+{
+  llvm::ErrorOr<unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(path + ".bc");
+  if (!buffer)
+    return false;
+  bitcode = buffer->get()->getBuffer().str();
+
+  // Replace build log with the log from the original build
+  ifstream log((path + ".log").c_str());
+  m_buildLog.assign(istreambuf_iterator<char>(log),
+                    istreambuf_iterator<char>());
+
+  return true;
+}
+
+void Program::storeInCache(const string& path, const string& bitcode) const
+{
+  // Write to temporary files and rename, so that concurrent builds of the
+  // same program never observe a partially written entry
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path));
+
+  int fd;
+  llvm::SmallString<128> tmpLog, tmpBitcode;
+  if (llvm::sys::fs::createUniqueFile(path + "-%%%%%%.log", fd, tmpLog))
+    return;
+  {
+    llvm::raw_fd_ostream stream(fd, true);
+    stream << m_buildLog;
+  }
+
+  if (llvm::sys::fs::createUniqueFile(path + "-%%%%%%.bc", fd, tmpBitcode))
+  {
+    llvm::sys::fs::remove(tmpLog);
+    return;
+  }
+  {
+    llvm::raw_fd_ostream stream(fd, true);
+    stream << bitcode;
+  }
+
+  // Publish the log first, since a cache hit is keyed on the bitcode
+  if (llvm::sys::fs::rename(tmpLog, path + ".log") ||
+      llvm::sys::fs::rename(tmpBitcode, path + ".bc"))
+  {
+    llvm::sys::fs::remove(tmpLog);
+    llvm::sys::fs::remove(tmpBitcode);
+  }
+}
+
+void Program::canonicalizeForInterpreter()
+{
+  for (llvm::Module::iterator F = m_module->begin(); F != m_module->end(); F++)
+  {
+    if (F->isDeclaration())
+      continue;
+
+    materializeConstantExprs(&*F);
+    foldGEPChains(&*F);
+    foldCastChains(&*F);
+  }
+}
+
 void Program::clearInterpreterCache()
 {
   InterpreterCacheMap::iterator itr;
@@ -626,7 +1122,32 @@ Program* Program::createFromBitcode(const Context *context,
                                     const unsigned char *bitcode,
                                     size_t length)
 {
-  // Load bitcode from file
+  // Check for an Oclgrind program binary, otherwise assume plain bitcode
+  // Binaries supplied by applications may be unaligned, so the header is
+  // copied out before it is read
+  BinaryHeader header;
+  string options;
+  uint32_t flags = 0;
+  if (length >= sizeof(BinaryHeader) &&
+      !memcmp(bitcode, BINARY_MAGIC, sizeof(header.magic)))
+  {
+    memcpy(&header, bitcode, sizeof(BinaryHeader));
+    if (header.version != BINARY_VERSION ||
+        header.pointerSize != sizeof(size_t) ||
+        length != sizeof(BinaryHeader) + header.optionsSize +
+                  header.bitcodeSize)
+    {
+      return NULL;
+    }
+
+    const char *data = (const char*)bitcode + sizeof(BinaryHeader);
+    options.assign(data, header.optionsSize);
+    flags = header.flags;
+    bitcode = (const unsigned char*)data + header.optionsSize;
+    length = header.bitcodeSize;
+  }
+
+  // Load bitcode from memory
   llvm::StringRef data((const char*)bitcode, length);
   unique_ptr<llvm::MemoryBuffer> buffer =
     llvm::MemoryBuffer::getMemBuffer(data, "", false);
@@ -636,6 +1157,7 @@ Program* Program::createFromBitcode(const Context *context,
   }
 
   // Parse bitcode into IR module
+  lock_guard<mutex> lock(context->getLLVMContextMutex());
 #if LLVM_VERSION < 40
   llvm::ErrorOr<unique_ptr<llvm::Module>> module =
 #else
@@ -647,7 +1169,11 @@ Program* Program::createFromBitcode(const Context *context,
     return NULL;
   }
 
-  return new Program(context, module.get().release());
+  Program *program = new Program(context, module.get().release());
+  program->m_buildOptions = options;
+  program->m_requiresUniformWorkGroups = flags & BINARY_UNIFORM_WORK_GROUPS;
+  program->m_bitcode = data.str();
+  return program;
 }
 
 Program* Program::createFromBitcodeFile(const Context *context,
@@ -661,25 +1187,15 @@ Program* Program::createFromBitcodeFile(const Context *context,
     return NULL;
   }
 
-  // Parse bitcode into IR module
-#if LLVM_VERSION < 40
-  llvm::ErrorOr<unique_ptr<llvm::Module>> module =
-#else
-  llvm::Expected<unique_ptr<llvm::Module>> module =
-#endif
-    parseBitcodeFile(buffer->get()->getMemBufferRef(),
-                     *context->getLLVMContext());
-  if (!module)
-  {
-    return NULL;
-  }
-
-  return new Program(context, module.get().release());
+  const unsigned char *data =
+    (const unsigned char*)buffer->get()->getBufferStart();
+  return createFromBitcode(context, data, buffer->get()->getBufferSize());
 }
 
 Program* Program::createFromPrograms(const Context *context,
                                      list<const Program*> programs)
 {
+  lock_guard<mutex> lock(context->getLLVMContextMutex());
   llvm::Module *module = new llvm::Module("oclgrind_linked",
                                           *context->getLLVMContext());
   llvm::Linker linker(*module);
@@ -745,6 +1261,7 @@ Kernel* Program::createKernel(const string name)
 
 void Program::deallocateProgramScopeVars()
 {
+  lock_guard<recursive_mutex> lock(m_context->getGlobalMemoryMutex());
   for (auto psv  = m_programScopeVars.begin();
             psv != m_programScopeVars.end();
             psv++)
@@ -761,12 +1278,21 @@ void Program::getBinary(unsigned char *binary) const
   if (!m_module)
     return;
 
-  std::string str;
-  llvm::raw_string_ostream stream(str);
-  llvm::WriteBitcodeToFile(m_module.get(), stream);
-  stream.str();
-
-  memcpy(binary, str.c_str(), str.length());
+  const string& bitcode = getBitcode();
+
+  BinaryHeader header;
+  memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+  header.version = BINARY_VERSION;
+  header.pointerSize = sizeof(size_t);
+  header.flags = m_requiresUniformWorkGroups ? BINARY_UNIFORM_WORK_GROUPS : 0;
+  header.optionsSize = m_buildOptions.size();
+  header.bitcodeSize = bitcode.size();
+
+  memcpy(binary, &header, sizeof(header));
+  binary += sizeof(header);
+  memcpy(binary, m_buildOptions.c_str(), m_buildOptions.size());
+  binary += m_buildOptions.size();
+  memcpy(binary, bitcode.c_str(), bitcode.size());
 }
 
 size_t Program::getBinarySize() const
@@ -776,11 +1302,18 @@ size_t Program::getBinarySize() const
     return 0;
   }
 
-  std::string str;
-  llvm::raw_string_ostream stream(str);
-  llvm::WriteBitcodeToFile(m_module.get(), stream);
-  stream.str();
-  return str.length();
+  return sizeof(BinaryHeader) + m_buildOptions.size() + getBitcode().size();
+}
+
+const string& Program::getBitcode() const
+{
+  // Serialize module on first use if it was not built from bitcode
+  if (m_bitcode.empty())
+  {
+    llvm::raw_string_ostream stream(m_bitcode);
+    llvm::WriteBitcodeToFile(m_module.get(), stream);
+  }
+  return m_bitcode;
 }
 
 const string& Program::getBuildLog() const
@@ -803,10 +1336,120 @@ const Context* Program::getContext() const
   return m_context;
 }
 
+void Program::foldCastChains(llvm::Function *function)
+{
+  // Get list of bitcast instructions
+  list<llvm::BitCastInst*> casts;
+  for (llvm::inst_iterator I = inst_begin(function), E = inst_end(function);
+       I != E; I++)
+  {
+    if (auto cast = llvm::dyn_cast<llvm::BitCastInst>(&*I))
+      casts.push_back(cast);
+  }
+
+  // Bypass intermediate casts, and remove casts that become no-ops
+  set<llvm::Instruction*> erased;
+  for (auto cast : casts)
+  {
+    if (erased.count(cast))
+      continue;
+
+    auto inner = llvm::dyn_cast<llvm::BitCastInst>(cast->getOperand(0));
+    if (!inner)
+      continue;
+
+    llvm::Value *source = inner->getOperand(0);
+    if (source->getType() == cast->getType())
+    {
+      cast->replaceAllUsesWith(source);
+      cast->eraseFromParent();
+      erased.insert(cast);
+    }
+    else
+    {
+      cast->setOperand(0, source);
+    }
+
+    if (inner->use_empty())
+    {
+      inner->eraseFromParent();
+      erased.insert(inner);
+    }
+  }
+}
+
+void Program::foldGEPChains(llvm::Function *function)
+{
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+
+    // Get list of GEP instructions
+    list<llvm::GetElementPtrInst*> geps;
+    for (llvm::inst_iterator I = inst_begin(function), E = inst_end(function);
+         I != E; I++)
+    {
+      if (auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(&*I))
+        geps.push_back(gep);
+    }
+
+    set<llvm::Instruction*> erased;
+    for (auto gep : geps)
+    {
+      if (erased.count(gep))
+        continue;
+
+      // Replace GEPs with all-zero indices that do not change the type
+      if (gep->hasAllZeroIndices() &&
+          gep->getType() == gep->getPointerOperandType())
+      {
+        gep->replaceAllUsesWith(gep->getPointerOperand());
+        gep->eraseFromParent();
+        erased.insert(gep);
+        changed = true;
+        continue;
+      }
+
+      // Merge GEP into its only user if that user starts with a zero index,
+      // keeping the original indices so that bounds checks still apply
+      auto inner = llvm::dyn_cast<llvm::GetElementPtrInst>(
+        gep->getPointerOperand());
+      if (!inner || !inner->hasOneUse() || gep->getNumIndices() < 1)
+        continue;
+      auto first = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(1));
+      if (!first || !first->isZero())
+        continue;
+
+      vector<llvm::Value*> indices(inner->idx_begin(), inner->idx_end());
+      indices.insert(indices.end(), gep->idx_begin() + 1, gep->idx_end());
+      llvm::GetElementPtrInst *merged = llvm::GetElementPtrInst::Create(
+        inner->getSourceElementType(), inner->getPointerOperand(),
+        indices, "", gep);
+      if (merged->getType() != gep->getType())
+      {
+        merged->eraseFromParent();
+        continue;
+      }
+      merged->takeName(gep);
+      merged->setDebugLoc(gep->getDebugLoc());
+      merged->setIsInBounds(inner->isInBounds() && gep->isInBounds());
+
+      gep->replaceAllUsesWith(merged);
+      gep->eraseFromParent();
+      inner->eraseFromParent();
+      erased.insert(gep);
+      erased.insert(inner);
+      changed = true;
+    }
+  }
+}
+
 unsigned long Program::generateUID() const
 {
-  srand(now());
-  return rand();
+  // Programs may be built concurrently, so avoid the shared rand() state
+  static atomic<unsigned long> counter(0);
+  return (unsigned long)now() + counter++;
 }
 
 const InterpreterCache* Program::getInterpreterCache(
@@ -876,6 +1519,53 @@ unsigned long Program::getUID() const
   return m_uid;
 }
 
+void Program::materializeConstantExprs(llvm::Function *function)
+{
+  // Constant expressions are re-evaluated on every use, so replace them
+  // with instructions in the entry block that are executed once per call
+  llvm::Instruction *insertPoint = &*function->getEntryBlock().begin();
+  map<llvm::ConstantExpr*, llvm::Instruction*> materialized;
+
+  // Materialize an expression and any nested expressions it uses
+  std::function<llvm::Instruction*(llvm::ConstantExpr*)> materialize =
+    [&](llvm::ConstantExpr *expr)
+  {
+    auto itr = materialized.find(expr);
+    if (itr != materialized.end())
+      return itr->second;
+
+    llvm::Instruction *inst = expr->getAsInstruction();
+    for (unsigned i = 0; i < inst->getNumOperands(); i++)
+    {
+      if (auto op = llvm::dyn_cast<llvm::ConstantExpr>(inst->getOperand(i)))
+        inst->setOperand(i, materialize(op));
+    }
+    inst->insertBefore(insertPoint);
+    materialized[expr] = inst;
+    return inst;
+  };
+
+  // New instructions are inserted behind the iterator, so are not visited
+  for (llvm::inst_iterator I = inst_begin(function), E = inst_end(function);
+       I != E; I++)
+  {
+    for (unsigned i = 0; i < I->getNumOperands(); i++)
+    {
+      auto expr = llvm::dyn_cast<llvm::ConstantExpr>(I->getOperand(i));
+      if (!expr || expr->canTrap())
+        continue;
+
+      // Leave callees and shuffle masks as constants
+      if (llvm::isa<llvm::CallInst>(*I) && i == I->getNumOperands() - 1)
+        continue;
+      if (llvm::isa<llvm::ShuffleVectorInst>(*I) && i == 2)
+        continue;
+
+      I->setOperand(i, materialize(expr));
+    }
+  }
+}
+
 void Program::pruneDeadCode(llvm::Instruction *instruction)
 {
   // Remove instructions that have no uses
@@ -8,6 +8,8 @@
 
 #include "common.h"
 
+#include <atomic>
+
 namespace llvm
 {
   class Function;
@@ -59,14 +61,26 @@ namespace oclgrind
     unsigned long getUID() const;
     bool requiresUniformWorkGroups() const;
 
+    // Statistics for the process-wide cache of built programs
+    struct BuildCacheStats
+    {
+      size_t hits;
+      size_t misses;
+      size_t evictions;
+      size_t entries;
+      size_t bytes;
+    };
+    static BuildCacheStats getBuildCacheStats();
+
   private:
     Program(const Context *context, llvm::Module *module);
 
     std::unique_ptr<llvm::Module> m_module;
+    mutable std::string m_bitcode;
     std::string m_source;
     std::string m_buildLog;
     std::string m_buildOptions;
-    unsigned int m_buildStatus;
+    std::atomic<unsigned int> m_buildStatus;
     const Context *m_context;
     std::vector<std::string> m_sourceLines;
 
@@ -80,6 +94,23 @@ namespace oclgrind
 
     void allocateProgramScopeVars();
     void deallocateProgramScopeVars();
+    std::string getCacheKey(const std::vector<const char*>& args,
+                            const std::list<Header>& headers,
+                            const char *pipeline) const;
+    bool loadFromCache(const std::string& path, std::string& bitcode);
+    void storeInCache(const std::string& path,
+                      const std::string& bitcode) const;
+    bool parseBitcode(const std::string& bitcode);
+    const std::string& getBitcode() const;
+
+    struct BuildCache;
+    bool loadFromBuildCache(const std::string& key, std::string& bitcode);
+    void storeInBuildCache(const std::string& key,
+                           const std::string& bitcode) const;
+    void canonicalizeForInterpreter();
+    void foldCastChains(llvm::Function *function);
+    void foldGEPChains(llvm::Function *function);
+    void materializeConstantExprs(llvm::Function *function);
     void pruneDeadCode(llvm::Instruction*);
     void removeLValueLoads();
     void scalarizeAggregateStore(llvm::StoreInst *store);
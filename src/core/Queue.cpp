@@ -9,6 +9,7 @@
 #include "common.h"
 
 #include <cassert>
+#include <mutex>
 
 #include "Context.h"
 #include "KernelInvocation.h"
@@ -225,6 +226,13 @@ Queue::Command* Queue::update()
   cmd->event->startTime = now();
   cmd->event->state = CL_RUNNING;
 
+  // Prevent global buffers being allocated by background program builds
+  // while commands access them (native kernels may call back into the API)
+  unique_lock<recursive_mutex> lock(m_context->getGlobalMemoryMutex(),
+                                    defer_lock);
+  if (cmd->type != NATIVE_KERNEL)
+    lock.lock();
+
   // Dispatch command
   switch (cmd->type)
   {
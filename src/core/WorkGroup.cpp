@@ -8,6 +8,7 @@
 
 #include "common.h"
 
+#include <mutex>
 #include <sstream>
 
 #include "llvm/IR/Module.h"
@@ -16,6 +17,7 @@
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
+#include "Program.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
 
@@ -29,49 +31,18 @@ WorkGroup::WorkGroup(const KernelInvocation *kernelInvocation, Size3 wgid)
 
 WorkGroup::WorkGroup(const KernelInvocation *kernelInvocation,
                      Size3 wgid, Size3 size)
- : m_context(kernelInvocation->getContext())
+ : m_context(kernelInvocation->getContext()),
+   m_kernelInvocation(kernelInvocation)
 {
-  m_groupID   = wgid;
-  m_groupSize = size;
-
-  m_groupIndex = (m_groupID.x +
-                 (m_groupID.y +
-                  m_groupID.z*(kernelInvocation->getNumGroups().y) *
-                  kernelInvocation->getNumGroups().x));
-
-  // Allocate local memory
   m_localMemory = new Memory(AddrSpaceLocal, sizeof(size_t)==8 ? 16 : 8,
                              m_context);
-  const Kernel *kernel = kernelInvocation->getKernel();
-  for (auto value = kernel->values_begin();
-            value != kernel->values_end();
-            value++)
-  {
-    const llvm::Type *type = value->first->getType();
-    if (type->isPointerTy() && type->getPointerAddressSpace() == AddrSpaceLocal)
-    {
-      size_t ptr = m_localMemory->allocateBuffer(value->second.size);
-      m_localAddresses[value->first] = ptr;
-    }
-  }
-
-  // Initialise work-items
-  for (size_t k = 0; k < m_groupSize.z; k++)
-  {
-    for (size_t j = 0; j < m_groupSize.y; j++)
-    {
-      for (size_t i = 0; i < m_groupSize.x; i++)
-      {
-        WorkItem *workItem = new WorkItem(kernelInvocation, this,
-                                          Size3(i, j, k));
-        m_workItems.push_back(workItem);
-        m_running.insert(workItem);
-      }
-    }
-  }
-
-  m_nextEvent = 1;
   m_barrier = NULL;
+  m_registers = NULL;
+  m_registersSize = 0;
+  m_uniformRegisters = NULL;
+  m_uniformSkipped = 0;
+
+  reset(wgid, size);
 }
 
 WorkGroup::~WorkGroup()
@@ -82,6 +53,9 @@ WorkGroup::~WorkGroup()
     delete m_workItems[i];
   }
 
+  delete[] m_registers;
+  delete[] m_uniformRegisters;
+  delete m_barrier;
   delete m_localMemory;
 }
 
@@ -111,6 +85,8 @@ size_t WorkGroup::async_copy(
     event
   };
 
+  lock_guard<mutex> lock(m_mutex);
+
   // Check if copy has already been registered by another work-item
   list< pair<AsyncCopy,set<const WorkItem*> > >::iterator itr;
   for (itr = m_asyncCopies.begin(); itr != m_asyncCopies.end(); itr++)
@@ -180,6 +156,16 @@ size_t WorkGroup::async_copy(
 }
 
 void WorkGroup::clearBarrier()
+{
+  // Plugin callbacks are compiled out of the uninstrumented path
+  if (m_context->isInstrumented())
+    releaseBarrier<true>();
+  else
+    releaseBarrier<false>();
+}
+
+template<bool instrumented>
+void WorkGroup::releaseBarrier()
 {
   assert(m_barrier);
 
@@ -235,8 +221,8 @@ void WorkGroup::clearBarrier()
       unsigned char *buffer = new unsigned char[itr->size];
       for (unsigned i = 0; i < itr->num; i++)
       {
-        srcMem->load(buffer, src, itr->size);
-        destMem->store(buffer, dest, itr->size);
+        srcMem->load<instrumented>(buffer, src, itr->size);
+        destMem->store<instrumented>(buffer, dest, itr->size);
         src += itr->srcStride * itr->size;
         dest += itr->destStride * itr->size;
       }
@@ -275,7 +261,8 @@ void WorkGroup::clearBarrier()
     m_barrier->events.remove(event);
   }
 
-  m_context->notifyWorkGroupBarrier(this, m_barrier->fence);
+  if (instrumented)
+    m_context->notifyWorkGroupBarrier(this, m_barrier->fence);
 
   delete m_barrier;
   m_barrier = NULL;
@@ -320,6 +307,37 @@ WorkItem* WorkGroup::getNextWorkItem() const
   return *m_running.begin();
 }
 
+unsigned char* WorkGroup::getRegisters() const
+{
+  return m_registers;
+}
+
+unsigned char* WorkGroup::getUniformRegisters() const
+{
+  return m_uniformRegisters;
+}
+
+size_t WorkGroup::getUniformSkipped() const
+{
+  return m_uniformSkipped;
+}
+
+const unsigned char* WorkGroup::getValueLanes(const llvm::Value *value) const
+{
+  if (!m_registers)
+    return NULL;
+
+  const Kernel *kernel = m_kernelInvocation->getKernel();
+  const InterpreterCache *cache =
+    kernel->getProgram()->getInterpreterCache(kernel->getFunction());
+  if (!cache->hasValue(value))
+    return NULL;
+
+  const InterpreterCache::ValueSlot& slot =
+    cache->getValueSlot(cache->getValueID(value));
+  return m_registers + slot.offset*m_workItems.size();
+}
+
 WorkItem* WorkGroup::getWorkItem(Size3 localID) const
 {
   return m_workItems[localID.x +
@@ -335,6 +353,8 @@ void WorkGroup::notifyBarrier(WorkItem *workItem,
                               const llvm::Instruction *instruction,
                               uint64_t fence, list<size_t> events)
 {
+  lock_guard<mutex> lock(m_mutex);
+
   if (!m_barrier)
   {
     // Create new barrier
@@ -426,6 +446,8 @@ void WorkGroup::notifyBarrier(WorkItem *workItem,
 
 void WorkGroup::notifyFinished(WorkItem *workItem)
 {
+  lock_guard<mutex> lock(m_mutex);
+
   m_running.erase(workItem);
 
   // Check if work-group finished without waiting for all events
@@ -435,6 +457,106 @@ void WorkGroup::notifyFinished(WorkItem *workItem)
   }
 }
 
+void WorkGroup::reset(Size3 wgid, Size3 size)
+{
+  m_groupID   = wgid;
+  m_groupSize = size;
+
+  m_groupIndex = (m_groupID.x +
+                 (m_groupID.y +
+                  m_groupID.z*(m_kernelInvocation->getNumGroups().y) *
+                  m_kernelInvocation->getNumGroups().x));
+
+  // Release state from any previous work-group run by this object
+  delete m_barrier;
+  m_barrier = NULL;
+  m_nextEvent = 1;
+  m_asyncCopies.clear();
+  m_events.clear();
+  m_running.clear();
+
+  // Allocate local memory
+  m_localMemory->clear();
+  m_localAddresses.clear();
+  const Kernel *kernel = m_kernelInvocation->getKernel();
+  for (auto value = kernel->values_begin();
+            value != kernel->values_end();
+            value++)
+  {
+    const llvm::Type *type = value->first->getType();
+    if (type->isPointerTy() && type->getPointerAddressSpace() == AddrSpaceLocal)
+    {
+      size_t ptr = m_localMemory->allocateBuffer(value->second.size);
+      m_localAddresses[value->first] = ptr;
+    }
+  }
+
+  // Allocate register file for all work-items if requested
+  size_t numWorkItems = size.x*size.y*size.z;
+  const InterpreterCache *cache =
+    kernel->getProgram()->getInterpreterCache(kernel->getFunction());
+  if (m_kernelInvocation->useGroupRegisters())
+  {
+    size_t registersSize = cache->getRegisterFileSize()*numWorkItems;
+    if (registersSize > m_registersSize)
+    {
+      delete[] m_registers;
+      m_registers = new unsigned char[registersSize];
+      m_registersSize = registersSize;
+    }
+  }
+
+  // Forget uniform values computed for any previous work-group
+  if (m_kernelInvocation->skipUniformValues())
+  {
+    if (!m_uniformRegisters)
+      m_uniformRegisters = new unsigned char[cache->getRegisterFileSize()];
+    m_uniformComputed.assign(cache->getNumValues(), false);
+    m_uniformSkipped = 0;
+  }
+
+  // Initialise work-items, reusing existing objects where possible
+  for (size_t i = numWorkItems; i < m_workItems.size(); i++)
+  {
+    delete m_workItems[i];
+  }
+  m_workItems.resize(min(m_workItems.size(), numWorkItems));
+  size_t index = 0;
+  for (size_t k = 0; k < m_groupSize.z; k++)
+  {
+    for (size_t j = 0; j < m_groupSize.y; j++)
+    {
+      for (size_t i = 0; i < m_groupSize.x; i++, index++)
+      {
+        WorkItem *workItem;
+        if (index < m_workItems.size())
+        {
+          workItem = m_workItems[index];
+          workItem->reset(this, Size3(i, j, k));
+        }
+        else
+        {
+          workItem = new WorkItem(m_kernelInvocation, this, Size3(i, j, k));
+          m_workItems.push_back(workItem);
+        }
+        m_running.insert(workItem);
+      }
+    }
+  }
+}
+
+bool WorkGroup::skipUniform(unsigned id)
+{
+  // Only the first work-item to reach a uniform instruction executes it
+  if (m_uniformComputed[id])
+  {
+    m_uniformSkipped++;
+    return true;
+  }
+  m_uniformComputed[id] = true;
+  return false;
+}
+
 bool WorkGroup::WorkItemCmp::operator()(const WorkItem *lhs,
                                         const WorkItem *rhs) const
 {
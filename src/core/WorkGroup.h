@@ -8,6 +8,8 @@
 
 #include "common.h"
 
+#include <mutex>
+
 #define CLK_LOCAL_MEM_FENCE  (1<<0)
 #define CLK_GLOBAL_MEM_FENCE (1<<1)
 
@@ -79,27 +81,48 @@ namespace oclgrind
     Memory* getLocalMemory() const;
     size_t getLocalMemoryAddress(const llvm::Value *value) const;
     WorkItem *getNextWorkItem() const;
+    unsigned char* getRegisters() const;
+    unsigned char* getUniformRegisters() const;
+    size_t getUniformSkipped() const;
+    const unsigned char* getValueLanes(const llvm::Value *value) const;
     WorkItem *getWorkItem(Size3 localID) const;
     bool hasBarrier() const;
     void notifyBarrier(WorkItem *workItem, const llvm::Instruction *instruction,
                        uint64_t fence,
                        std::list<size_t> events=std::list<size_t>());
     void notifyFinished(WorkItem *workItem);
+    void reset(Size3 wgid, Size3 size);
+    bool skipUniform(unsigned id);
 
   private:
     size_t m_groupIndex;
     Size3 m_groupID;
     Size3 m_groupSize;
     const Context *m_context;
+    const KernelInvocation *m_kernelInvocation;
 
     Memory *m_localMemory;
     std::map<const llvm::Value*,size_t> m_localAddresses;
 
     std::vector<WorkItem*> m_workItems;
 
+    // Structure-of-arrays register file shared by all work-items
+    unsigned char *m_registers;
+    size_t m_registersSize;
+
+    // Results of uniform instructions, computed once for all work-items
+    unsigned char *m_uniformRegisters;
+    std::vector<bool> m_uniformComputed;
+    size_t m_uniformSkipped;
+
     Barrier *m_barrier;
     size_t m_nextEvent;
     std::list< std::pair<AsyncCopy,std::set<const WorkItem*> > > m_asyncCopies;
     std::map < size_t, std::list<AsyncCopy> > m_events;
+
+    // Guards barrier and async copy state when work-items run in parallel
+    std::mutex m_mutex;
+
+    template<bool instrumented> void releaseBarrier();
   };
 }
@@ -24,6 +24,7 @@
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
+#include "Plugin.h"
 #include "Program.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
@@ -31,95 +32,185 @@
 using namespace oclgrind;
 using namespace std;
 
+// Use computed goto for instruction dispatch where supported
+#if defined(__GNUC__)
+#define HAVE_COMPUTED_GOTO 1
+#endif
+
+// Instruction handlers, in dispatch table order
+#define HANDLERS(H)     \
+  H(add)                \
+  H(alloc)              \
+  H(ashr)               \
+  H(bitcast)            \
+  H(br)                 \
+  H(bwand)              \
+  H(bwor)               \
+  H(bwxor)              \
+  H(call)               \
+  H(extractelem)        \
+  H(extractval)         \
+  H(fadd)               \
+  H(fcmp)               \
+  H(fdiv)               \
+  H(fmul)               \
+  H(fpext)              \
+  H(fptosi)             \
+  H(fptoui)             \
+  H(fptrunc)            \
+  H(frem)               \
+  H(fsub)               \
+  H(gep)                \
+  H(icmp)               \
+  H(insertelem)         \
+  H(insertval)          \
+  H(inttoptr)           \
+  H(itrunc)             \
+  H(load)               \
+  H(lshr)               \
+  H(mul)                \
+  H(phi)                \
+  H(ptrtoint)           \
+  H(ret)                \
+  H(sdiv)               \
+  H(select)             \
+  H(sext)               \
+  H(shl)                \
+  H(shuffle)            \
+  H(sitofp)             \
+  H(srem)               \
+  H(store)              \
+  H(sub)                \
+  H(swtch)              \
+  H(udiv)               \
+  H(uitofp)             \
+  H(uniform)            \
+  H(unreachable)        \
+  H(unsupported)        \
+  H(urem)               \
+  H(zext)               \
+  H(add_i32)            \
+  H(add_i64)            \
+  H(bwand_i32)          \
+  H(bwand_i64)          \
+  H(bwor_i32)           \
+  H(bwor_i64)           \
+  H(bwxor_i32)          \
+  H(bwxor_i64)          \
+  H(fadd_f32)           \
+  H(fadd_f64)           \
+  H(fcmp_f32)           \
+  H(fcmp_f64)           \
+  H(fdiv_f32)           \
+  H(fdiv_f64)           \
+  H(fmul_f32)           \
+  H(fmul_f64)           \
+  H(fsub_f32)           \
+  H(fsub_f64)           \
+  H(icmp_i32)           \
+  H(icmp_i64)           \
+  H(mul_i32)            \
+  H(mul_i64)            \
+  H(sub_i32)            \
+  H(sub_i64)
+
+#define HANDLER_INDEX(name) HANDLER_##name,
+enum HandlerIndex
+{
+  HANDLERS(HANDLER_INDEX)
+};
+#undef HANDLER_INDEX
+
 struct WorkItem::Position
 {
   bool hasBegun;
-  const llvm::BasicBlock *             prevBlock;
-  const llvm::BasicBlock *             currBlock;
-  const llvm::BasicBlock *             nextBlock;
-  llvm::BasicBlock::const_iterator     currInst;
-  std::stack<const llvm::Instruction*> callStack;
-  std::stack< std::list<size_t> >      allocations;
+  const InterpreterCache::Block *                  prevBlock;
+  const InterpreterCache::Block *                  currBlock;
+  const InterpreterCache::Block *                  nextBlock;
+  const InterpreterCache::Instruction *            currInst;
+  std::stack<const llvm::Instruction*>             callStack;
+  std::stack<const InterpreterCache::Instruction*> returnStack;
+  std::stack< std::list<size_t> >                  allocations;
 };
 
 WorkItem::WorkItem(const KernelInvocation *kernelInvocation,
                    WorkGroup *workGroup, Size3 lid)
   : m_context(kernelInvocation->getContext()),
-    m_kernelInvocation(kernelInvocation),
-    m_workGroup(workGroup)
+    m_kernelInvocation(kernelInvocation)
 {
-  m_localID = lid;
-
-  // Compute global ID
-  Size3 groupID = workGroup->getGroupID();
-  Size3 groupSize = kernelInvocation->getLocalSize();
-  Size3 globalOffset = kernelInvocation->getGlobalOffset();
-  m_globalID.x = lid.x + groupID.x*groupSize.x + globalOffset.x;
-  m_globalID.y = lid.y + groupID.y*groupSize.y + globalOffset.y;
-  m_globalID.z = lid.z + groupID.z*groupSize.z + globalOffset.z;
-
-  Size3 globalSize = kernelInvocation->getGlobalSize();
-  m_globalIndex = (m_globalID.x +
-                  (m_globalID.y +
-                   m_globalID.z*globalSize.y) * globalSize.x);
-
   const Kernel *kernel = kernelInvocation->getKernel();
 
   // Load interpreter cache
   m_cache = kernel->getProgram()->getInterpreterCache(kernel->getFunction());
 
-  // Set initial number of values to store based on cache
   m_values.resize(m_cache->getNumValues());
+  m_registers = NULL;
+  m_ownRegisters = NULL;
+  m_uniformRegisters = NULL;
+  m_lane = 0;
+  m_numLanes = 0;
 
   m_privateMemory = new Memory(AddrSpacePrivate, sizeof(size_t)==8 ? 32 : 16,
                                m_context);
+  m_instrumented = m_context->isInstrumented();
+  m_position = new Position;
 
-  // Initialise kernel arguments and global variables
-  for (auto value  = kernel->values_begin();
-            value != kernel->values_end();
-            value++)
+  reset(workGroup, lid);
+}
+
+WorkItem::~WorkItem()
+{
+  delete[] m_ownRegisters;
+  delete m_privateMemory;
+  delete m_position;
+}
+
+void WorkItem::advance()
+{
+  m_position->currInst++;
+
+  if (m_position->nextBlock)
   {
-    pair<unsigned,unsigned> size = getValueSize(value->first);
-    TypedValue v = {
-      size.first,
-      size.second,
-      m_pool.alloc(size.first*size.second)
-    };
+    // Move to next basic block
+    m_position->prevBlock = m_position->currBlock;
+    m_position->currBlock = m_position->nextBlock;
+    m_position->nextBlock = NULL;
+    m_position->currInst  = &m_position->currBlock->instructions.front();
+  }
+}
 
-    const llvm::Type *type = value->first->getType();
-    if (type->isPointerTy() &&
-        type->getPointerAddressSpace() == AddrSpacePrivate)
-    {
-      size_t sz = value->second.size*value->second.num;
-      v.setPointer(m_privateMemory->allocateBuffer(sz, 0, value->second.data));
-    }
-    else if (type->isPointerTy() &&
-             type->getPointerAddressSpace() == AddrSpaceLocal)
-    {
-      v.setPointer(m_workGroup->getLocalMemoryAddress(value->first));
-    }
-    else
+TypedValue WorkItem::beginInstruction(
+  const InterpreterCache::Instruction *instruction)
+{
+  // Prepare result
+  TypedValue result = {
+    instruction->resultSize,
+    instruction->resultNum,
+    NULL
+  };
+  if (result.size)
+  {
+    result.data = getRegister(instruction->resultOffset,
+                              instruction->allocSize);
+  }
+
+  if (instruction->opcode != llvm::Instruction::PHI &&
+      m_phiTemps.size() > 0)
+  {
+    for (auto itr = m_phiTemps.begin(); itr != m_phiTemps.end(); itr++)
     {
-      memcpy(v.data, value->second.data, v.size*v.num);
+      memcpy(m_values[itr->first].data, itr->second.data,
+             itr->second.size*itr->second.num);
     }
-
-    setValue(value->first, v);
+    m_phiTemps.clear();
   }
 
-  // Initialize interpreter state
-  m_state    = READY;
-  m_position = new Position;
-  m_position->hasBegun = false;
-  m_position->prevBlock = NULL;
-  m_position->nextBlock = NULL;
-  m_position->currBlock = &*kernel->getFunction()->begin();
-  m_position->currInst = m_position->currBlock->begin();
+  return result;
 }
 
-WorkItem::~WorkItem()
+bool WorkItem::atSamePosition(const WorkItem *other) const
 {
-  delete m_privateMemory;
-  delete m_position;
+  return m_position->currInst == other->m_position->currInst;
 }
 
 void WorkItem::clearBarrier()
@@ -130,228 +221,229 @@ void WorkItem::clearBarrier()
   }
 }
 
-void WorkItem::dispatch(const llvm::Instruction *instruction,
+template<bool instrumented>
+void WorkItem::dispatch(const InterpreterCache::Instruction *instruction,
                         TypedValue& result)
 {
-  switch (instruction->getOpcode())
+  switch (instruction->handler)
   {
-  case llvm::Instruction::Add:
-    add(instruction, result);
+#define HANDLER_CASE(name)                    \
+  case HANDLER_##name:                        \
+    name<instrumented>(instruction, result);  \
     break;
+  HANDLERS(HANDLER_CASE)
+#undef HANDLER_CASE
+  }
+}
+
+template<bool instrumented>
+void WorkItem::endInstruction(const InterpreterCache::Instruction *instruction,
+                              TypedValue& result)
+{
+  // Results are written in place, but PHI nodes are committed later
+  if (result.size && instruction->opcode == llvm::Instruction::PHI)
+  {
+    m_phiTemps.push_back(make_pair(instruction->resultID, result));
+  }
+
+  if (instrumented)
+    m_context->notifyInstructionExecuted(this, instruction->inst, result);
+}
+
+void WorkItem::execute(const InterpreterCache::Instruction *instruction)
+{
+  TypedValue result = beginInstruction(instruction);
+  if (m_instrumented)
+  {
+    dispatch<true>(instruction, result);
+    endInstruction<true>(instruction, result);
+  }
+  else
+  {
+    dispatch<false>(instruction, result);
+    endInstruction<false>(instruction, result);
+  }
+}
+
+const stack<const llvm::Instruction*>& WorkItem::getCallStack() const
+{
+  return m_position->callStack;
+}
+
+const llvm::BasicBlock* WorkItem::getCurrentBlock() const
+{
+  return m_position->currBlock->block;
+}
+
+const llvm::Instruction* WorkItem::getCurrentInstruction() const
+{
+  return m_position->currInst->inst;
+}
+
+Size3 WorkItem::getGlobalID() const
+{
+  return m_globalID;
+}
+
+size_t WorkItem::getGlobalIndex() const
+{
+  return m_globalIndex;
+}
+
+unsigned WorkItem::getHandler(unsigned opcode)
+{
+  switch (opcode)
+  {
+  case llvm::Instruction::Add:
+    return HANDLER_add;
   case llvm::Instruction::Alloca:
-    alloc(instruction, result);
-    break;
+    return HANDLER_alloc;
   case llvm::Instruction::And:
-    bwand(instruction, result);
-    break;
+    return HANDLER_bwand;
   case llvm::Instruction::AShr:
-    ashr(instruction, result);
-    break;
+    return HANDLER_ashr;
   case llvm::Instruction::BitCast:
-    bitcast(instruction, result);
-    break;
+    return HANDLER_bitcast;
   case llvm::Instruction::Br:
-    br(instruction, result);
-    break;
+    return HANDLER_br;
   case llvm::Instruction::Call:
-    call(instruction, result);
-    break;
+    return HANDLER_call;
   case llvm::Instruction::ExtractElement:
-    extractelem(instruction, result);
-    break;
+    return HANDLER_extractelem;
   case llvm::Instruction::ExtractValue:
-    extractval(instruction, result);
-    break;
+    return HANDLER_extractval;
   case llvm::Instruction::FAdd:
-    fadd(instruction, result);
-    break;
+    return HANDLER_fadd;
   case llvm::Instruction::FCmp:
-    fcmp(instruction, result);
-    break;
+    return HANDLER_fcmp;
   case llvm::Instruction::FDiv:
-    fdiv(instruction, result);
-    break;
+    return HANDLER_fdiv;
   case llvm::Instruction::FMul:
-    fmul(instruction, result);
-    break;
+    return HANDLER_fmul;
   case llvm::Instruction::FPExt:
-    fpext(instruction, result);
-    break;
+    return HANDLER_fpext;
   case llvm::Instruction::FPToSI:
-    fptosi(instruction, result);
-    break;
+    return HANDLER_fptosi;
   case llvm::Instruction::FPToUI:
-    fptoui(instruction, result);
-    break;
+    return HANDLER_fptoui;
   case llvm::Instruction::FPTrunc:
-    fptrunc(instruction, result);
-    break;
+    return HANDLER_fptrunc;
   case llvm::Instruction::FRem:
-    frem(instruction, result);
-    break;
+    return HANDLER_frem;
   case llvm::Instruction::FSub:
-    fsub(instruction, result);
-    break;
+    return HANDLER_fsub;
   case llvm::Instruction::GetElementPtr:
-    gep(instruction, result);
-    break;
+    return HANDLER_gep;
   case llvm::Instruction::ICmp:
-    icmp(instruction, result);
-    break;
+    return HANDLER_icmp;
   case llvm::Instruction::InsertElement:
-    insertelem(instruction, result);
-    break;
+    return HANDLER_insertelem;
   case llvm::Instruction::InsertValue:
-    insertval(instruction, result);
-    break;
+    return HANDLER_insertval;
   case llvm::Instruction::IntToPtr:
-    inttoptr(instruction, result);
-    break;
+    return HANDLER_inttoptr;
   case llvm::Instruction::Load:
-    load(instruction, result);
-    break;
+    return HANDLER_load;
   case llvm::Instruction::LShr:
-    lshr(instruction, result);
-    break;
+    return HANDLER_lshr;
   case llvm::Instruction::Mul:
-    mul(instruction, result);
-    break;
+    return HANDLER_mul;
   case llvm::Instruction::Or:
-    bwor(instruction, result);
-    break;
+    return HANDLER_bwor;
   case llvm::Instruction::PHI:
-    phi(instruction, result);
-    break;
+    return HANDLER_phi;
   case llvm::Instruction::PtrToInt:
-    ptrtoint(instruction, result);
-    break;
+    return HANDLER_ptrtoint;
   case llvm::Instruction::Ret:
-    ret(instruction, result);
-    break;
+    return HANDLER_ret;
   case llvm::Instruction::SDiv:
-    sdiv(instruction, result);
-    break;
+    return HANDLER_sdiv;
   case llvm::Instruction::Select:
-    select(instruction, result);
-    break;
+    return HANDLER_select;
   case llvm::Instruction::SExt:
-    sext(instruction, result);
-    break;
+    return HANDLER_sext;
   case llvm::Instruction::Shl:
-    shl(instruction, result);
-    break;
+    return HANDLER_shl;
   case llvm::Instruction::ShuffleVector:
-    shuffle(instruction, result);
-    break;
+    return HANDLER_shuffle;
   case llvm::Instruction::SIToFP:
-    sitofp(instruction, result);
-    break;
+    return HANDLER_sitofp;
   case llvm::Instruction::SRem:
-    srem(instruction, result);
-    break;
+    return HANDLER_srem;
   case llvm::Instruction::Store:
-    store(instruction, result);
-    break;
+    return HANDLER_store;
   case llvm::Instruction::Sub:
-    sub(instruction, result);
-    break;
+    return HANDLER_sub;
   case llvm::Instruction::Switch:
-    swtch(instruction, result);
-    break;
+    return HANDLER_swtch;
   case llvm::Instruction::Trunc:
-    itrunc(instruction, result);
-    break;
+    return HANDLER_itrunc;
   case llvm::Instruction::UDiv:
-    udiv(instruction, result);
-    break;
+    return HANDLER_udiv;
   case llvm::Instruction::UIToFP:
-    uitofp(instruction, result);
-    break;
+    return HANDLER_uitofp;
   case llvm::Instruction::URem:
-    urem(instruction, result);
-    break;
+    return HANDLER_urem;
   case llvm::Instruction::Unreachable:
-    FATAL_ERROR("Encountered unreachable instruction");
+    return HANDLER_unreachable;
   case llvm::Instruction::Xor:
-    bwxor(instruction, result);
-    break;
+    return HANDLER_bwxor;
   case llvm::Instruction::ZExt:
-    zext(instruction, result);
-    break;
+    return HANDLER_zext;
   default:
-    FATAL_ERROR("Unsupported instruction: %s", instruction->getOpcodeName());
+    return HANDLER_unsupported;
   }
 }
 
-void WorkItem::execute(const llvm::Instruction *instruction)
+unsigned WorkItem::getTypedHandler(unsigned handler,
+                                   const llvm::Instruction *inst)
 {
-  // Prepare private variable for instruction result
-  pair<unsigned,unsigned> resultSize = getValueSize(instruction);
-
-  // Prepare result
-  TypedValue result = {
-    resultSize.first,
-    resultSize.second,
-    NULL
-  };
-  if (result.size)
-  {
-    result.data = m_pool.alloc(result.size*result.num);
-  }
-
-  if (instruction->getOpcode() != llvm::Instruction::PHI &&
-      m_phiTemps.size() > 0)
+  // Comparisons are specialised on their operand type
+  const llvm::Type *type = inst->getType()->getScalarType();
+  if (handler == HANDLER_icmp || handler == HANDLER_fcmp)
   {
-    TypedValueMap::iterator itr;
-    for (itr = m_phiTemps.begin(); itr != m_phiTemps.end(); itr++)
-    {
-      setValue(itr->first, itr->second);
-    }
-    m_phiTemps.clear();
+    // Constant predicates are left to the generic handler
+    llvm::CmpInst::Predicate pred =
+      ((const llvm::CmpInst*)inst)->getPredicate();
+    if (pred == llvm::CmpInst::FCMP_FALSE || pred == llvm::CmpInst::FCMP_TRUE)
+      return handler;
+    type = inst->getOperand(0)->getType()->getScalarType();
   }
 
-  // Execute instruction
-  dispatch(instruction, result);
+  bool i32 = type->isIntegerTy(32);
+  bool i64 = type->isIntegerTy(64);
+  bool f32 = type->isFloatTy();
+  bool f64 = type->isDoubleTy();
 
-  // Store result
-  if (result.size)
+  switch (handler)
   {
-    if (instruction->getOpcode() != llvm::Instruction::PHI)
-    {
-      setValue(instruction, result);
-    }
-    else
-    {
-      m_phiTemps[instruction] = result;
-    }
+#define TYPED_INT_HANDLER(name)                           \
+  case HANDLER_##name:                                    \
+    if (i32) return HANDLER_##name##_i32;                 \
+    if (i64) return HANDLER_##name##_i64;                 \
+    break;
+#define TYPED_FLOAT_HANDLER(name)                         \
+  case HANDLER_##name:                                    \
+    if (f32) return HANDLER_##name##_f32;                 \
+    if (f64) return HANDLER_##name##_f64;                 \
+    break;
+  TYPED_INT_HANDLER(add)
+  TYPED_INT_HANDLER(bwand)
+  TYPED_INT_HANDLER(bwor)
+  TYPED_INT_HANDLER(bwxor)
+  TYPED_FLOAT_HANDLER(fadd)
+  TYPED_FLOAT_HANDLER(fcmp)
+  TYPED_FLOAT_HANDLER(fdiv)
+  TYPED_FLOAT_HANDLER(fmul)
+  TYPED_FLOAT_HANDLER(fsub)
+  TYPED_INT_HANDLER(icmp)
+  TYPED_INT_HANDLER(mul)
+  TYPED_INT_HANDLER(sub)
+#undef TYPED_INT_HANDLER
+#undef TYPED_FLOAT_HANDLER
   }
 
-  m_context->notifyInstructionExecuted(this, instruction, result);
-}
-
-const stack<const llvm::Instruction*>& WorkItem::getCallStack() const
-{
-  return m_position->callStack;
-}
-
-const llvm::BasicBlock* WorkItem::getCurrentBlock() const
-{
-  return m_position->currBlock;
-}
-
-const llvm::Instruction* WorkItem::getCurrentInstruction() const
-{
-  return &*m_position->currInst;
-}
-
-Size3 WorkItem::getGlobalID() const
-{
-  return m_globalID;
-}
-
-size_t WorkItem::getGlobalIndex() const
-{
-  return m_globalIndex;
+  return handler;
 }
 
 Size3 WorkItem::getLocalID() const
@@ -398,17 +490,16 @@ TypedValue WorkItem::getOperand(const llvm::Value *operand) const
   //}
   else if (valID == llvm::Value::ConstantExprVal)
   {
-    pair<unsigned,unsigned> size = getValueSize(operand);
-    TypedValue result;
-    result.size = size.first;
-    result.num  = size.second;
-    result.data = m_pool.alloc(getTypeSize(operand->getType()));
+    // Use the result of an expression that was evaluated ahead of time
+    if (m_cache->hasConstant(operand))
+      return m_cache->getConstant(operand);
+    else if (m_cache->hasValue(operand))
+      return getValue(operand);
 
-    // Use of const_cast here is ugly, but ConstExpr instructions
-    // shouldn't actually modify WorkItem state anyway
-    const_cast<WorkItem*>(this)->dispatch(
-      m_cache->getConstantExpr(operand), result);
-    return result;
+    InterpreterCache::Operand expr;
+    expr.kind = InterpreterCache::Operand::CONSTEXPR;
+    expr.expr = m_cache->getConstantExpr(operand);
+    return getOperand(expr);
   }
   else if (valID == llvm::Value::UndefValueVal            ||
            valID == llvm::Value::ConstantAggregateZeroVal ||
@@ -447,9 +538,41 @@ TypedValue WorkItem::getOperand(const llvm::Value *operand) const
   assert(false);
 }
 
+TypedValue WorkItem::getOperand(
+  const InterpreterCache::Operand& operand) const
+{
+  switch (operand.kind)
+  {
+  case InterpreterCache::Operand::VALUE:
+    return m_values[operand.valueID];
+  case InterpreterCache::Operand::CONSTANT:
+    return operand.constant;
+  case InterpreterCache::Operand::CONSTEXPR:
+  {
+    const InterpreterCache::Instruction *expr = operand.expr;
+    TypedValue result = {
+      expr->resultSize,
+      expr->resultNum,
+      getRegister(expr->resultOffset, expr->allocSize)
+    };
+
+    // Use of const_cast here is ugly, but ConstExpr instructions
+    // shouldn't actually modify WorkItem state anyway
+    const_cast<WorkItem*>(this)->dispatch(expr, result);
+    return result;
+  }
+  default:
+    FATAL_ERROR("Unhandled operand type");
+  }
+}
+
 const llvm::BasicBlock* WorkItem::getPreviousBlock() const
 {
-  return m_position->prevBlock;
+  if (!m_position->prevBlock)
+  {
+    return NULL;
+  }
+  return m_position->prevBlock->block;
 }
 
 Memory* WorkItem::getPrivateMemory() const
@@ -457,6 +580,12 @@ Memory* WorkItem::getPrivateMemory() const
   return m_privateMemory;
 }
 
+unsigned char* WorkItem::getRegister(size_t offset, size_t size) const
+{
+  // Each slot is expanded to an array with one element per lane
+  return m_registers + offset*m_numLanes + m_lane*size;
+}
+
 WorkItem::State WorkItem::getState() const
 {
   return m_state;
@@ -515,7 +644,7 @@ void WorkItem::printExpression(string expr) const
   }
 
   // Check global variables
-  string globalName = m_position->currBlock->getParent()->getName();
+  string globalName = m_position->currBlock->block->getParent()->getName();
   globalName += ".";
   globalName += basename;
   const llvm::Module *module =
@@ -719,56 +848,593 @@ bool WorkItem::printValue(const llvm::Value *value) const
   return true;
 }
 
-void WorkItem::setValue(const llvm::Value *key, TypedValue value)
+void WorkItem::reset(WorkGroup *workGroup, Size3 lid)
 {
-  m_values[m_cache->getValueID(key)] = value;
-}
+  m_workGroup = workGroup;
+  m_localID = lid;
 
-WorkItem::State WorkItem::step()
-{
-  assert(m_state == READY);
+  // Compute global ID
+  Size3 groupID = workGroup->getGroupID();
+  Size3 groupSize = m_kernelInvocation->getLocalSize();
+  Size3 globalOffset = m_kernelInvocation->getGlobalOffset();
+  m_globalID.x = lid.x + groupID.x*groupSize.x + globalOffset.x;
+  m_globalID.y = lid.y + groupID.y*groupSize.y + globalOffset.y;
+  m_globalID.z = lid.z + groupID.z*groupSize.z + globalOffset.z;
 
-  if (!m_position->hasBegun)
+  Size3 globalSize = m_kernelInvocation->getGlobalSize();
+  m_globalIndex = (m_globalID.x +
+                  (m_globalID.y +
+                   m_globalID.z*globalSize.y) * globalSize.x);
+
+  // Use a lane of the work-group register file if it has one
+  unsigned char *registers = workGroup->getRegisters();
+  if (registers)
   {
-    m_position->hasBegun = true;
-    m_context->notifyWorkItemBegin(this);
+    Size3 size = workGroup->getGroupSize();
+    setRegisters(registers, lid.x + (lid.y + lid.z*size.y)*size.x,
+                 size.x*size.y*size.z);
   }
-
-  // Execute the next instruction
-  execute(&*m_position->currInst);
-
-  // Check if we've reached the end of the block
-  if (++m_position->currInst == m_position->currBlock->end() ||
-      m_position->nextBlock)
+  else
   {
-    if (m_position->nextBlock)
-    {
-      // Move to next basic block
-      m_position->prevBlock = m_position->currBlock;
-      m_position->currBlock = m_position->nextBlock;
-      m_position->nextBlock = NULL;
-      m_position->currInst  = m_position->currBlock->begin();
-    }
+    if (!m_ownRegisters)
+      m_ownRegisters = new unsigned char[m_cache->getRegisterFileSize()];
+    setRegisters(m_ownRegisters, 0, 1);
   }
 
-  if (m_state == FINISHED)
-    m_context->notifyWorkItemComplete(this);
-
-  return m_state;
-}
-
+  // Release state from any previous work-item run by this object
+  m_pool.reset();
+  m_privateMemory->clear();
+  m_variables.clear();
+  m_phiTemps.clear();
+
+  // Initialise kernel arguments and global variables
+  const Kernel *kernel = m_kernelInvocation->getKernel();
+  for (auto value  = kernel->values_begin();
+            value != kernel->values_end();
+            value++)
+  {
+    TypedValue v = getValue(value->first);
+
+    const llvm::Type *type = value->first->getType();
+    if (type->isPointerTy() &&
+        type->getPointerAddressSpace() == AddrSpacePrivate)
+    {
+      size_t sz = value->second.size*value->second.num;
+      v.setPointer(m_privateMemory->allocateBuffer(sz, 0, value->second.data));
+    }
+    else if (type->isPointerTy() &&
+             type->getPointerAddressSpace() == AddrSpaceLocal)
+    {
+      v.setPointer(m_workGroup->getLocalMemoryAddress(value->first));
+    }
+    else
+    {
+      memcpy(v.data, value->second.data, v.size*v.num);
+    }
+  }
+
+  // Evaluate constant expressions that depend on the addresses above
+  m_cache->evaluateConstantExprs(this);
+
+  // Initialize interpreter state
+  m_state    = READY;
+  m_yield    = false;
+  *m_position = Position();
+  m_position->hasBegun = false;
+  m_position->prevBlock = NULL;
+  m_position->nextBlock = NULL;
+  m_position->currBlock = m_cache->getBlock(&*kernel->getFunction()->begin());
+  m_position->currInst = &m_position->currBlock->instructions.front();
+}
+
+template<bool instrumented>
+WorkItem::State WorkItem::interpret()
+{
+  assert(m_state == READY);
+
+  if (!m_position->hasBegun)
+  {
+    m_position->hasBegun = true;
+    if (instrumented)
+      m_context->notifyWorkItemBegin(this);
+  }
+
+  // Execute instructions until we hit a barrier, finish, or are asked to stop
+  m_yield = false;
+  const InterpreterCache::Instruction *instruction;
+  TypedValue result;
+
+#ifdef HAVE_COMPUTED_GOTO
+#define HANDLER_LABEL(name) &&label_##name,
+  static const void *labels[] = { HANDLERS(HANDLER_LABEL) };
+#undef HANDLER_LABEL
+
+#define DISPATCH                                \
+  if (m_state != READY || m_yield)              \
+    goto done;                                  \
+  instruction = m_position->currInst;           \
+  result = beginInstruction(instruction);       \
+  goto *labels[instruction->handler];
+
+  DISPATCH
+
+  // Each handler dispatches the next instruction directly
+#define HANDLER_LABEL(name)                             \
+label_##name:                                           \
+  name<instrumented>(instruction, result);              \
+  endInstruction<instrumented>(instruction, result);    \
+  advance();                                            \
+  DISPATCH
+  HANDLERS(HANDLER_LABEL)
+#undef HANDLER_LABEL
+#undef DISPATCH
+
+done:
+#else
+  while (m_state == READY && !m_yield)
+  {
+    instruction = m_position->currInst;
+    result = beginInstruction(instruction);
+    dispatch<instrumented>(instruction, result);
+    endInstruction<instrumented>(instruction, result);
+    advance();
+  }
+#endif
+
+  if (instrumented && m_state == FINISHED)
+    m_context->notifyWorkItemComplete(this);
+
+  return m_state;
+}
+
+WorkItem::State WorkItem::run()
+{
+  // Plugin callbacks are compiled out of the uninstrumented interpreter
+  if (m_instrumented)
+    return interpret<true>();
+  else
+    return interpret<false>();
+}
+
+bool WorkItem::runsBefore(const WorkItem *other) const
+{
+  // Work-items inside a function call must return before their callers
+  // continue, and otherwise the earliest instruction in the program goes
+  // first, so that work-items on both sides of a branch reconverge
+  size_t depth      = m_position->callStack.size();
+  size_t otherDepth = other->m_position->callStack.size();
+  if (depth != otherDepth)
+    return depth > otherDepth;
+  return m_position->currInst->index < other->m_position->currInst->index;
+}
+
+void WorkItem::setRegisters(unsigned char *registers,
+                            size_t lane, size_t numLanes)
+{
+  unsigned char *uniformRegisters = m_workGroup->getUniformRegisters();
+  if (registers == m_registers && lane == m_lane && numLanes == m_numLanes &&
+      uniformRegisters == m_uniformRegisters)
+    return;
+
+  m_registers = registers;
+  m_lane = lane;
+  m_numLanes = numLanes;
+  m_uniformRegisters = uniformRegisters;
+
+  // Point each value at its slot in the register file, or at the copy
+  // shared by the work-group for uniform values
+  for (unsigned i = 0; i < m_values.size(); i++)
+  {
+    const InterpreterCache::ValueSlot& slot = m_cache->getValueSlot(i);
+    m_values[i].size = slot.size;
+    m_values[i].num  = slot.num;
+    if (!slot.size)
+      m_values[i].data = NULL;
+    else if (slot.uniform && m_uniformRegisters)
+      m_values[i].data = m_uniformRegisters + slot.offset;
+    else
+      m_values[i].data = getRegister(slot.offset, slot.size*slot.num);
+  }
+}
+
+WorkItem::State WorkItem::step()
+{
+  assert(m_state == READY);
+
+  if (!m_position->hasBegun)
+  {
+    m_position->hasBegun = true;
+    if (m_instrumented)
+      m_context->notifyWorkItemBegin(this);
+  }
+
+  // Execute the next instruction
+  execute(m_position->currInst);
+  advance();
+
+  if (m_instrumented && m_state == FINISHED)
+    m_context->notifyWorkItemComplete(this);
+
+  return m_state;
+}
+
+namespace
+{
+  // Element-wise operations for lockstep and type-specialised arithmetic
+  struct OpAdd
+  {
+    template<typename T> T operator()(T a, T b) const { return a + b; }
+  };
+  struct OpSub
+  {
+    template<typename T> T operator()(T a, T b) const { return a - b; }
+  };
+  struct OpMul
+  {
+    template<typename T> T operator()(T a, T b) const
+    {
+      return (uint64_t)a * b;
+    }
+  };
+  struct OpMulF
+  {
+    template<typename T> T operator()(T a, T b) const { return a * b; }
+  };
+  struct OpDiv
+  {
+    template<typename T> T operator()(T a, T b) const { return a / b; }
+  };
+  struct OpAnd
+  {
+    template<typename T> T operator()(T a, T b) const { return a & b; }
+  };
+  struct OpOr
+  {
+    template<typename T> T operator()(T a, T b) const { return a | b; }
+  };
+  struct OpXor
+  {
+    template<typename T> T operator()(T a, T b) const { return a ^ b; }
+  };
+
+  // Compare each pair of elements, producing all ones for true elements of
+  // vector results and 1 for true scalar results
+  template<typename T, typename Cmp>
+  void compareElements(unsigned char *result, const unsigned char *a,
+                       const unsigned char *b, unsigned num, Cmp cmp)
+  {
+    uint8_t t = num > 1 ? -1 : 1;
+    const T *x = (const T*)a;
+    const T *y = (const T*)b;
+    for (unsigned i = 0; i < num; i++)
+      result[i] = cmp(x[i], y[i]) ? t : 0;
+  }
+
+  template<typename U, typename S>
+  void compareInts(llvm::CmpInst::Predicate pred, unsigned char *result,
+                   const unsigned char *a, const unsigned char *b,
+                   unsigned num)
+  {
+    switch (pred)
+    {
+    case llvm::CmpInst::ICMP_EQ:
+      compareElements<U>(result, a, b, num, [](U x, U y){ return x == y; });
+      break;
+    case llvm::CmpInst::ICMP_NE:
+      compareElements<U>(result, a, b, num, [](U x, U y){ return x != y; });
+      break;
+    case llvm::CmpInst::ICMP_UGT:
+      compareElements<U>(result, a, b, num, [](U x, U y){ return x > y; });
+      break;
+    case llvm::CmpInst::ICMP_UGE:
+      compareElements<U>(result, a, b, num, [](U x, U y){ return x >= y; });
+      break;
+    case llvm::CmpInst::ICMP_ULT:
+      compareElements<U>(result, a, b, num, [](U x, U y){ return x < y; });
+      break;
+    case llvm::CmpInst::ICMP_ULE:
+      compareElements<U>(result, a, b, num, [](U x, U y){ return x <= y; });
+      break;
+    case llvm::CmpInst::ICMP_SGT:
+      compareElements<S>(result, a, b, num, [](S x, S y){ return x > y; });
+      break;
+    case llvm::CmpInst::ICMP_SGE:
+      compareElements<S>(result, a, b, num, [](S x, S y){ return x >= y; });
+      break;
+    case llvm::CmpInst::ICMP_SLT:
+      compareElements<S>(result, a, b, num, [](S x, S y){ return x < y; });
+      break;
+    case llvm::CmpInst::ICMP_SLE:
+      compareElements<S>(result, a, b, num, [](S x, S y){ return x <= y; });
+      break;
+    default:
+      FATAL_ERROR("Unsupported ICmp predicate: %d", pred);
+    }
+  }
+
+  // Unordered predicates are the negation of the opposite ordered predicate
+  template<typename T>
+  void compareFloats(llvm::CmpInst::Predicate pred, unsigned char *result,
+                     const unsigned char *a, const unsigned char *b,
+                     unsigned num)
+  {
+    switch (pred)
+    {
+    case llvm::CmpInst::FCMP_OEQ:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x == y; });
+      break;
+    case llvm::CmpInst::FCMP_ONE:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x < y || x > y; });
+      break;
+    case llvm::CmpInst::FCMP_OGT:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x > y; });
+      break;
+    case llvm::CmpInst::FCMP_OGE:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x >= y; });
+      break;
+    case llvm::CmpInst::FCMP_OLT:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x < y; });
+      break;
+    case llvm::CmpInst::FCMP_OLE:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x <= y; });
+      break;
+    case llvm::CmpInst::FCMP_ORD:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x == x && y == y; });
+      break;
+    case llvm::CmpInst::FCMP_UEQ:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return !(x < y || x > y); });
+      break;
+    case llvm::CmpInst::FCMP_UNE:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x != y; });
+      break;
+    case llvm::CmpInst::FCMP_UGT:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return !(x <= y); });
+      break;
+    case llvm::CmpInst::FCMP_UGE:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return !(x < y); });
+      break;
+    case llvm::CmpInst::FCMP_ULT:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return !(x >= y); });
+      break;
+    case llvm::CmpInst::FCMP_ULE:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return !(x > y); });
+      break;
+    case llvm::CmpInst::FCMP_UNO:
+      compareElements<T>(result, a, b, num,
+                         [](T x, T y){ return x != x || y != y; });
+      break;
+    default:
+      FATAL_ERROR("Unsupported FCmp predicate: %d", pred);
+    }
+  }
+
+  // Apply an operation element-wise, where a uniform operand is a single
+  // scalar shared by every element
+  template<typename T, typename Op>
+  void applyElementwise(unsigned char *result,
+                        const unsigned char *a, bool uniformA,
+                        const unsigned char *b, bool uniformB,
+                        size_t count, Op op)
+  {
+    T *r = (T*)result;
+    const T *x = (const T*)a;
+    const T *y = (const T*)b;
+    if (uniformA)
+    {
+      T s = *x;
+      for (size_t i = 0; i < count; i++)
+        r[i] = op(s, y[i]);
+    }
+    else if (uniformB)
+    {
+      T s = *y;
+      for (size_t i = 0; i < count; i++)
+        r[i] = op(x[i], s);
+    }
+    else
+    {
+      for (size_t i = 0; i < count; i++)
+        r[i] = op(x[i], y[i]);
+    }
+  }
+
+  template<typename Op>
+  void applyIntLanes(unsigned size, unsigned char *result,
+                     const unsigned char *a, bool uniformA,
+                     const unsigned char *b, bool uniformB,
+                     size_t count, Op op)
+  {
+    switch (size)
+    {
+    case 1:
+      applyElementwise<uint8_t>(result, a, uniformA, b, uniformB, count, op);
+      break;
+    case 2:
+      applyElementwise<uint16_t>(result, a, uniformA, b, uniformB, count, op);
+      break;
+    case 4:
+      applyElementwise<uint32_t>(result, a, uniformA, b, uniformB, count, op);
+      break;
+    case 8:
+      applyElementwise<uint64_t>(result, a, uniformA, b, uniformB, count, op);
+      break;
+    }
+  }
+
+  template<typename Op>
+  void applyFloatLanes(unsigned size, unsigned char *result,
+                       const unsigned char *a, bool uniformA,
+                       const unsigned char *b, bool uniformB,
+                       size_t count, Op op)
+  {
+    if (size == 4)
+      applyElementwise<float>(result, a, uniformA, b, uniformB, count, op);
+    else
+      applyElementwise<double>(result, a, uniformA, b, uniformB, count, op);
+  }
+}
+
+bool WorkItem::stepLanes(WorkItem *const *lanes, size_t numLanes)
+{
+  // Vectorised execution needs at least two work-items that all share a
+  // register file and occupy adjacent lanes within it
+  const WorkItem *first = lanes[0];
+  if (numLanes < 2 || first->m_numLanes < 2)
+    return false;
+  for (size_t i = 0; i < numLanes; i++)
+  {
+    if (!lanes[i]->m_position->hasBegun ||
+        lanes[i]->m_registers != first->m_registers ||
+        lanes[i]->m_lane != first->m_lane + i)
+      return false;
+  }
+
+  // Plugins observing instructions need to see each work-item separately
+  if (first->m_instrumented &&
+      first->m_context->hasEventListeners(Plugin::INSTRUCTION_EXECUTED))
+    return false;
+
+  // Only binary arithmetic on registers and scalar constants is vectorised
+  const InterpreterCache::Instruction *instruction =
+    first->m_position->currInst;
+  unsigned size = instruction->resultSize;
+  if (instruction->handler == HANDLER_uniform)
+    return false;
+  switch (instruction->opcode)
+  {
+  case llvm::Instruction::Add:
+  case llvm::Instruction::And:
+  case llvm::Instruction::Mul:
+  case llvm::Instruction::Or:
+  case llvm::Instruction::Sub:
+  case llvm::Instruction::Xor:
+    if (size != 1 && size != 2 && size != 4 && size != 8)
+      return false;
+    break;
+  case llvm::Instruction::FAdd:
+  case llvm::Instruction::FDiv:
+  case llvm::Instruction::FMul:
+  case llvm::Instruction::FSub:
+    if (size != 4 && size != 8)
+      return false;
+    break;
+  default:
+    return false;
+  }
+
+  const unsigned char *data[2];
+  bool uniform[2];
+  for (unsigned i = 0; i < 2; i++)
+  {
+    const InterpreterCache::Operand& operand = instruction->operands[i];
+    if (operand.kind == InterpreterCache::Operand::VALUE)
+    {
+      data[i] = first->m_values[operand.valueID].data;
+      uniform[i] = false;
+    }
+    else if (operand.kind == InterpreterCache::Operand::CONSTANT &&
+             operand.constant.num == 1)
+    {
+      data[i] = operand.constant.data;
+      uniform[i] = true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  if (uniform[0] && uniform[1])
+    return false;
+
+  // Commit any pending PHI nodes before reading operands
+  for (size_t i = 0; i < numLanes; i++)
+    lanes[i]->beginInstruction(instruction);
+
+  size_t count = numLanes*instruction->resultNum;
+  unsigned char *result =
+    first->getRegister(instruction->resultOffset, instruction->allocSize);
+  switch (instruction->opcode)
+  {
+  case llvm::Instruction::Add:
+    applyIntLanes(size, result, data[0], uniform[0],
+                  data[1], uniform[1], count, OpAdd());
+    break;
+  case llvm::Instruction::And:
+    applyIntLanes(size, result, data[0], uniform[0],
+                  data[1], uniform[1], count, OpAnd());
+    break;
+  case llvm::Instruction::Or:
+    applyIntLanes(size, result, data[0], uniform[0],
+                  data[1], uniform[1], count, OpOr());
+    break;
+  case llvm::Instruction::Xor:
+    applyIntLanes(size, result, data[0], uniform[0],
+                  data[1], uniform[1], count, OpXor());
+    break;
+  case llvm::Instruction::FAdd:
+    applyFloatLanes(size, result, data[0], uniform[0],
+                    data[1], uniform[1], count, OpAdd());
+    break;
+  case llvm::Instruction::FDiv:
+    applyFloatLanes(size, result, data[0], uniform[0],
+                    data[1], uniform[1], count, OpDiv());
+    break;
+  case llvm::Instruction::FMul:
+    applyFloatLanes(size, result, data[0], uniform[0],
+                    data[1], uniform[1], count, OpMulF());
+    break;
+  case llvm::Instruction::FSub:
+    applyFloatLanes(size, result, data[0], uniform[0],
+                    data[1], uniform[1], count, OpSub());
+    break;
+  case llvm::Instruction::Mul:
+    applyIntLanes(size, result, data[0], uniform[0],
+                  data[1], uniform[1], count, OpMul());
+    break;
+  case llvm::Instruction::Sub:
+    applyIntLanes(size, result, data[0], uniform[0],
+                  data[1], uniform[1], count, OpSub());
+    break;
+  }
+
+  for (size_t i = 0; i < numLanes; i++)
+    lanes[i]->advance();
+
+  return true;
+}
+
+void WorkItem::yield()
+{
+  m_yield = true;
+}
+
 
 ///////////////////////////////
-//// Instruction execution ////
-///////////////////////////////
+//// Instruction execution ////
+///////////////////////////////
 
-#define INSTRUCTION(name) \
-  void WorkItem::name(const llvm::Instruction *instruction, TypedValue& result)
+#define INSTRUCTION(name)                                          \
+  template<bool instrumented>                                      \
+  void WorkItem::name(const InterpreterCache::Instruction *instruction, \
+                      TypedValue& result)
 
 INSTRUCTION(add)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) + opB.getUInt(i), i);
@@ -777,12 +1443,8 @@ INSTRUCTION(add)
 
 INSTRUCTION(alloc)
 {
-  const llvm::AllocaInst *allocInst = ((const llvm::AllocaInst*)instruction);
-  const llvm::Type *type = allocInst->getAllocatedType();
-
   // Perform allocation
-  unsigned size = getTypeSize(type);
-  size_t address = m_privateMemory->allocateBuffer(size);
+  size_t address = m_privateMemory->allocateBuffer(instruction->immediate);
   if (!address)
     FATAL_ERROR("Insufficient private memory (alloca)");
 
@@ -796,8 +1458,8 @@ INSTRUCTION(alloc)
 
 INSTRUCTION(ashr)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -809,31 +1471,29 @@ INSTRUCTION(ashr)
 
 INSTRUCTION(bitcast)
 {
-  TypedValue operand = getOperand(instruction->getOperand(0));
+  TypedValue operand = getOperand(instruction->operands[0]);
   memcpy(result.data, operand.data, result.size*result.num);
 }
 
 INSTRUCTION(br)
 {
-  if (instruction->getNumOperands() == 1)
+  if (instruction->blocks.size() == 1)
   {
     // Unconditional branch
-    m_position->nextBlock = (const llvm::BasicBlock*)instruction->getOperand(0);
+    m_position->nextBlock = instruction->blocks[0];
   }
   else
   {
-    // Conditional branch
-    bool pred = getOperand(instruction->getOperand(0)).getUInt();
-    const llvm::Value *iftrue = instruction->getOperand(2);
-    const llvm::Value *iffalse = instruction->getOperand(1);
-    m_position->nextBlock = (const llvm::BasicBlock*)(pred ? iftrue : iffalse);
+    // Conditional branch (blocks are stored as [iffalse, iftrue])
+    bool pred = getOperand(instruction->operands[0]).getUInt();
+    m_position->nextBlock = instruction->blocks[pred ? 1 : 0];
   }
 }
 
 INSTRUCTION(bwand)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) & opB.getUInt(i), i);
@@ -842,8 +1502,8 @@ INSTRUCTION(bwand)
 
 INSTRUCTION(bwor)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) | opB.getUInt(i), i);
@@ -852,8 +1512,8 @@ INSTRUCTION(bwor)
 
 INSTRUCTION(bwxor)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) ^ opB.getUInt(i), i);
@@ -862,113 +1522,69 @@ INSTRUCTION(bwxor)
 
 INSTRUCTION(call)
 {
-  const llvm::CallInst *callInst = (const llvm::CallInst*)instruction;
-  const llvm::Function *function = callInst->getCalledFunction();
-
-  // Check for indirect function calls
-  if (!callInst->getCalledFunction())
-  {
-    // Resolve indirect function pointer
-    const llvm::Value *func = callInst->getCalledValue();
-    const llvm::Value *funcPtr = ((const llvm::User*)func)->getOperand(0);
-    function = (const llvm::Function*)funcPtr;
-  }
-
   // Check if function has definition
-  if (!function->isDeclaration())
+  if (!instruction->builtin)
   {
-    m_position->callStack.push(&*m_position->currInst);
+    m_position->callStack.push(instruction->inst);
+    m_position->returnStack.push(instruction);
     m_position->allocations.push(list<size_t>());
-    m_position->nextBlock = &*function->begin();
+    m_position->nextBlock = instruction->blocks[0];
 
     // Set function arguments
-    llvm::Function::const_arg_iterator argItr;
-    for (argItr = function->arg_begin();
-         argItr != function->arg_end(); argItr++)
+    for (unsigned i = 0; i < instruction->argIDs.size(); i++)
     {
-      const llvm::Value *arg = callInst->getArgOperand(argItr->getArgNo());
-      TypedValue value = getOperand(arg);
+      TypedValue value = getOperand(instruction->operands[i]);
 
-      if (argItr->hasByValAttr())
+      if (instruction->sizes[i])
       {
         // Make new copy of value in private memory
         void *data = m_privateMemory->getPointer(value.getPointer());
-        size_t size = getTypeSize(argItr->getType()->getPointerElementType());
+        size_t size = instruction->sizes[i];
         size_t ptr  = m_privateMemory->allocateBuffer(size, 0, (uint8_t*)data);
         m_position->allocations.top().push_back(ptr);
 
         // Pass new allocation to function
-        TypedValue address =
-        {
-          sizeof(size_t),
-          1,
-          m_pool.alloc(sizeof(size_t))
-        };
-        address.setPointer(ptr);
-        setValue(&*argItr, address);
+        m_values[instruction->argIDs[i]].setPointer(ptr);
       }
       else
       {
-        setValue(&*argItr, m_pool.clone(value));
+        memcpy(m_values[instruction->argIDs[i]].data, value.data,
+               value.size*value.num);
       }
     }
 
     return;
   }
 
+  // Builtin functions only use the pool for temporary storage
+  m_pool.reset();
+
   // Call builtin function
-  InterpreterCache::Builtin builtin = m_cache->getBuiltin(function);
-  builtin.function.func(this, callInst,
-                        builtin.name, builtin.overload,
-                        result, builtin.function.op);
+  const InterpreterCache::Builtin *builtin = instruction->builtin;
+  builtin->function.func(this, (const llvm::CallInst*)instruction->inst,
+                         builtin->name, builtin->overload,
+                         result, builtin->function.op);
 }
 
 INSTRUCTION(extractelem)
 {
-  const llvm::ExtractElementInst *extract =
-    (const llvm::ExtractElementInst*)instruction;
-  unsigned index     = getOperand(extract->getIndexOperand()).getUInt();
-  TypedValue operand = getOperand(extract->getVectorOperand());
+  unsigned index     = getOperand(instruction->operands[1]).getUInt();
+  TypedValue operand = getOperand(instruction->operands[0]);
   memcpy(result.data, operand.data + result.size*index, result.size);
 }
 
 INSTRUCTION(extractval)
 {
-  const llvm::ExtractValueInst *extract =
-    (const llvm::ExtractValueInst*)instruction;
-  const llvm::Value *agg = extract->getAggregateOperand();
-  llvm::ArrayRef<unsigned int> indices = extract->getIndices();
-
-  // Compute offset for target value
-  int offset = 0;
-  const llvm::Type *type = agg->getType();
-  for (unsigned i = 0; i < indices.size(); i++)
-  {
-    if (type->isArrayTy())
-    {
-      type = type->getArrayElementType();
-      offset += getTypeSize(type) * indices[i];
-    }
-    else if (type->isStructTy())
-    {
-      offset += getStructMemberOffset((const llvm::StructType*)type,
-                                      indices[i]);
-      type = type->getStructElementType(indices[i]);
-    }
-    else
-    {
-      FATAL_ERROR("Unsupported aggregate type: %d", type->getTypeID())
-    }
-  }
-
   // Copy target value to result
-  memcpy(result.data, getOperand(agg).data + offset, getTypeSize(type));
+  TypedValue agg = getOperand(instruction->operands[0]);
+  memcpy(result.data, agg.data + instruction->immediate,
+         result.size*result.num);
 }
 
 INSTRUCTION(fadd)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) + opB.getFloat(i), i);
@@ -977,11 +1593,11 @@ INSTRUCTION(fadd)
 
 INSTRUCTION(fcmp)
 {
-  const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction;
+  const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction->inst;
   llvm::CmpInst::Predicate pred = cmpInst->getPredicate();
 
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
 
   uint64_t t = result.num > 1 ? -1 : 1;
   for (unsigned i = 0; i < result.num; i++)
@@ -1040,8 +1656,8 @@ INSTRUCTION(fcmp)
 
 INSTRUCTION(fdiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) / opB.getFloat(i), i);
@@ -1050,8 +1666,8 @@ INSTRUCTION(fdiv)
 
 INSTRUCTION(fmul)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) * opB.getFloat(i), i);
@@ -1060,7 +1676,7 @@ INSTRUCTION(fmul)
 
 INSTRUCTION(fpext)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getFloat(i), i);
@@ -1069,7 +1685,7 @@ INSTRUCTION(fpext)
 
 INSTRUCTION(fptosi)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setSInt((int64_t)op.getFloat(i), i);
@@ -1078,7 +1694,7 @@ INSTRUCTION(fptosi)
 
 INSTRUCTION(fptoui)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt((uint64_t)op.getFloat(i), i);
@@ -1087,8 +1703,8 @@ INSTRUCTION(fptoui)
 
 INSTRUCTION(frem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(fmod(opA.getFloat(i), opB.getFloat(i)), i);
@@ -1097,7 +1713,7 @@ INSTRUCTION(frem)
 
 INSTRUCTION(fptrunc)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getFloat(i), i);
@@ -1106,8 +1722,8 @@ INSTRUCTION(fptrunc)
 
 INSTRUCTION(fsub)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) - opB.getFloat(i), i);
@@ -1116,31 +1732,30 @@ INSTRUCTION(fsub)
 
 INSTRUCTION(gep)
 {
-  const llvm::GetElementPtrInst *gepInst =
-    (const llvm::GetElementPtrInst*)instruction;
-
-  // Get base address
-  size_t base = getOperand(gepInst->getPointerOperand()).getPointer();
-  const llvm::Type *ptrType = gepInst->getPointerOperandType();
+  // Get base address, including offsets from constant struct indices
+  size_t address = getOperand(instruction->operands[0]).getPointer();
+  address += instruction->immediate;
 
-  // Get indices
-  std::vector<int64_t> offsets;
-  llvm::User::const_op_iterator opItr;
-  for (opItr = gepInst->idx_begin(); opItr != gepInst->idx_end(); opItr++)
+  // Apply indices using pre-computed element sizes
+  for (unsigned i = 1; i < instruction->operands.size(); i++)
   {
-    offsets.push_back(getOperand(opItr->get()).getSInt());
+    size_t stride = instruction->sizes[i-1];
+    if (stride)
+    {
+      address += getOperand(instruction->operands[i]).getSInt()*stride;
+    }
   }
 
-  result.setPointer(resolveGEP(base, ptrType, offsets));
+  result.setPointer(address);
 }
 
 INSTRUCTION(icmp)
 {
-  const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction;
+  const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction->inst;
   llvm::CmpInst::Predicate pred = cmpInst->getPredicate();
 
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
 
   uint64_t t = result.num > 1 ? -1 : 1;
   for (unsigned i = 0; i < result.num; i++)
@@ -1194,54 +1809,28 @@ INSTRUCTION(icmp)
 
 INSTRUCTION(insertelem)
 {
-  TypedValue vector  = getOperand(instruction->getOperand(0));
-  TypedValue element = getOperand(instruction->getOperand(1));
-  unsigned index     = getOperand(instruction->getOperand(2)).getUInt();
+  TypedValue vector  = getOperand(instruction->operands[0]);
+  TypedValue element = getOperand(instruction->operands[1]);
+  unsigned index     = getOperand(instruction->operands[2]).getUInt();
   memcpy(result.data, vector.data, result.size*result.num);
   memcpy(result.data + index*result.size, element.data, result.size);
 }
 
 INSTRUCTION(insertval)
 {
-  const llvm::InsertValueInst *insert =
-    (const llvm::InsertValueInst*)instruction;
-
   // Load original aggregate data
-  const llvm::Value *agg = insert->getAggregateOperand();
-  memcpy(result.data, getOperand(agg).data, result.size*result.num);
-
-  // Compute offset for inserted value
-  int offset = 0;
-  llvm::ArrayRef<unsigned int> indices = insert->getIndices();
-  const llvm::Type *type = agg->getType();
-  for (unsigned i = 0; i < indices.size(); i++)
-  {
-    if (type->isArrayTy())
-    {
-      type = type->getArrayElementType();
-      offset += getTypeSize(type) * indices[i];
-    }
-    else if (type->isStructTy())
-    {
-      offset += getStructMemberOffset((const llvm::StructType*)type,
-                                      indices[i]);
-      type = type->getStructElementType(indices[i]);
-    }
-    else
-    {
-      FATAL_ERROR("Unsupported aggregate type: %d", type->getTypeID())
-    }
-  }
+  TypedValue agg = getOperand(instruction->operands[0]);
+  memcpy(result.data, agg.data, result.size*result.num);
 
   // Copy inserted value into result
-  const llvm::Value *value = insert->getInsertedValueOperand();
-  memcpy(result.data + offset, getOperand(value).data,
-         getTypeSize(value->getType()));
+  TypedValue value = getOperand(instruction->operands[1]);
+  memcpy(result.data + instruction->immediate, value.data,
+         value.size*value.num);
 }
 
 INSTRUCTION(inttoptr)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setPointer(op.getUInt(i), i);
@@ -1250,7 +1839,7 @@ INSTRUCTION(inttoptr)
 
 INSTRUCTION(itrunc)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(op.getUInt(i), i);
@@ -1259,29 +1848,25 @@ INSTRUCTION(itrunc)
 
 INSTRUCTION(load)
 {
-  const llvm::LoadInst *loadInst = (const llvm::LoadInst*)instruction;
-  unsigned addressSpace = loadInst->getPointerAddressSpace();
-  const llvm::Value *opPtr = loadInst->getPointerOperand();
-  size_t address = getOperand(opPtr).getPointer();
+  unsigned addressSpace = instruction->addressSpace;
+  size_t address = getOperand(instruction->operands[0]).getPointer();
 
   // Check address is correctly aligned
-  unsigned alignment = loadInst->getAlignment();
-  if (!alignment)
-    alignment = getTypeAlignment(opPtr->getType()->getPointerElementType());
-  if (address & (alignment-1))
+  if (address & (instruction->alignment-1))
   {
     m_context->logError("Invalid memory load - source pointer is "
                         "not aligned to the pointed type");
   }
 
   // Load data
-  getMemory(addressSpace)->load(result.data, address, result.size*result.num);
+  getMemory(addressSpace)->load<instrumented>(result.data, address,
+                                              result.size*result.num);
 }
 
 INSTRUCTION(lshr)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -1293,8 +1878,8 @@ INSTRUCTION(lshr)
 
 INSTRUCTION(mul)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) * opB.getUInt(i), i);
@@ -1303,15 +1888,21 @@ INSTRUCTION(mul)
 
 INSTRUCTION(phi)
 {
-  const llvm::PHINode *phiNode = (const llvm::PHINode*)instruction;
-  const llvm::Value *value = phiNode->getIncomingValueForBlock(
-    (const llvm::BasicBlock*)m_position->prevBlock);
-  memcpy(result.data, getOperand(value).data, result.size*result.num);
+  // Find incoming value for previous block
+  for (unsigned i = 0; i < instruction->blocks.size(); i++)
+  {
+    if (instruction->blocks[i] == m_position->prevBlock)
+    {
+      TypedValue value = getOperand(instruction->operands[i]);
+      memcpy(result.data, value.data, result.size*result.num);
+      return;
+    }
+  }
 }
 
 INSTRUCTION(ptrtoint)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(op.getPointer(i), i);
@@ -1320,20 +1911,19 @@ INSTRUCTION(ptrtoint)
 
 INSTRUCTION(ret)
 {
-  const llvm::ReturnInst *retInst = (const llvm::ReturnInst*)instruction;
-
-  if (!m_position->callStack.empty())
+  if (!m_position->returnStack.empty())
   {
-    m_position->currInst =
-      llvm::BasicBlock::const_iterator(m_position->callStack.top());
-    m_position->currBlock = m_position->currInst->getParent();
+    m_position->currInst = m_position->returnStack.top();
+    m_position->currBlock = m_position->currInst->block;
     m_position->callStack.pop();
+    m_position->returnStack.pop();
 
     // Set return value
-    const llvm::Value *returnVal = retInst->getReturnValue();
-    if (returnVal)
+    if (!instruction->operands.empty())
     {
-      setValue(&*m_position->currInst, m_pool.clone(getOperand(returnVal)));
+      TypedValue value = getOperand(instruction->operands[0]);
+      memcpy(m_values[m_position->currInst->resultID].data, value.data,
+             value.size*value.num);
     }
 
     // Clear stack allocations
@@ -1355,8 +1945,8 @@ INSTRUCTION(ret)
 
 INSTRUCTION(sdiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t a = opA.getSInt(i);
@@ -1372,17 +1962,16 @@ INSTRUCTION(sdiv)
 
 INSTRUCTION(select)
 {
-  const llvm::SelectInst *selectInst = (const llvm::SelectInst*)instruction;
-  TypedValue opCondition = getOperand(selectInst->getCondition());
+  TypedValue opCondition = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     const bool cond =
-      selectInst->getCondition()->getType()->isVectorTy() ?
+      opCondition.num > 1 ?
       opCondition.getUInt(i) :
       opCondition.getUInt();
-    const llvm::Value *op = cond ?
-      selectInst->getTrueValue() :
-      selectInst->getFalseValue();
+    const InterpreterCache::Operand& op = cond ?
+      instruction->operands[1] :
+      instruction->operands[2];
     memcpy(result.data + i*result.size,
            getOperand(op).data + i*result.size,
            result.size);
@@ -1391,12 +1980,11 @@ INSTRUCTION(select)
 
 INSTRUCTION(sext)
 {
-  const llvm::Value *operand = instruction->getOperand(0);
-  TypedValue value = getOperand(operand);
+  TypedValue value = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t val = value.getSInt(i);
-    if (operand->getType()->getPrimitiveSizeInBits() == 1)
+    if (instruction->immediate == 1)
     {
       val = val ? -1 : 0;
     }
@@ -1406,8 +1994,8 @@ INSTRUCTION(sext)
 
 INSTRUCTION(shl)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -1419,38 +2007,33 @@ INSTRUCTION(shl)
 
 INSTRUCTION(shuffle)
 {
-  const llvm::ShuffleVectorInst *shuffle =
-    (const llvm::ShuffleVectorInst*)instruction;
-
-  const llvm::Value *v1 = shuffle->getOperand(0);
-  const llvm::Value *v2 = shuffle->getOperand(1);
-  TypedValue mask = getOperand(shuffle->getMask());
+  TypedValue v1 = getOperand(instruction->operands[0]);
+  TypedValue v2 = getOperand(instruction->operands[1]);
 
-  unsigned num = v1->getType()->getVectorNumElements();
+  unsigned num = v1.num;
   for (unsigned i = 0; i < result.num; i++)
   {
-    if (shuffle->getMask()->getAggregateElement(i)->getValueID()
-          == llvm::Value::UndefValueVal)
+    int index = instruction->mask[i];
+    if (index < 0)
     {
       // Don't care / undef
       continue;
     }
 
-    const llvm::Value *src = v1;
-    unsigned int index = mask.getUInt(i);
-    if (index >= num)
+    const TypedValue *src = &v1;
+    if ((unsigned)index >= num)
     {
       index -= num;
-      src = v2;
+      src = &v2;
     }
     memcpy(result.data + i*result.size,
-           getOperand(src).data + index*result.size, result.size);
+           src->data + index*result.size, result.size);
   }
 }
 
 INSTRUCTION(sitofp)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getSInt(i), i);
@@ -1459,8 +2042,8 @@ INSTRUCTION(sitofp)
 
 INSTRUCTION(srem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t a = opA.getSInt(i);
@@ -1476,31 +2059,26 @@ INSTRUCTION(srem)
 
 INSTRUCTION(store)
 {
-  const llvm::StoreInst *storeInst = (const llvm::StoreInst*)instruction;
-  unsigned addressSpace = storeInst->getPointerAddressSpace();
-  const llvm::Value *opPtr = storeInst->getPointerOperand();
-  size_t address = getOperand(opPtr).getPointer();
+  unsigned addressSpace = instruction->addressSpace;
+  size_t address = getOperand(instruction->operands[1]).getPointer();
 
   // Check address is correctly aligned
-  unsigned alignment = storeInst->getAlignment();
-  if (!alignment)
-    alignment = getTypeAlignment(opPtr->getType()->getPointerElementType());
-  if (address & (alignment-1))
+  if (address & (instruction->alignment-1))
   {
     m_context->logError("Invalid memory store - source pointer is "
                         "not aligned to the pointed type");
   }
 
   // Store data
-  TypedValue operand = getOperand(storeInst->getValueOperand());
-  getMemory(addressSpace)->store(operand.data, address,
-                                 operand.size*operand.num);
+  TypedValue operand = getOperand(instruction->operands[0]);
+  getMemory(addressSpace)->store<instrumented>(operand.data, address,
+                                               operand.size*operand.num);
 }
 
 INSTRUCTION(sub)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) - opB.getUInt(i), i);
@@ -1509,22 +2087,23 @@ INSTRUCTION(sub)
 
 INSTRUCTION(swtch)
 {
-  const llvm::SwitchInst *swtch = (const llvm::SwitchInst*)instruction;
-  const llvm::Value *cond = swtch->getCondition();
-  uint64_t val = getOperand(cond).getUInt();
-  const llvm::ConstantInt *cval =
-    (const llvm::ConstantInt*)llvm::ConstantInt::get(cond->getType(), val);
-#if LLVM_VERSION < 50
-  m_position->nextBlock = swtch->findCaseValue(cval).getCaseSuccessor();
-#else
-  m_position->nextBlock = swtch->findCaseValue(cval)->getCaseSuccessor();
-#endif
+  // Operands are [condition, case values...], blocks are [default, cases...]
+  uint64_t val = getOperand(instruction->operands[0]).getUInt();
+  m_position->nextBlock = instruction->blocks[0];
+  for (unsigned i = 1; i < instruction->operands.size(); i++)
+  {
+    if (getOperand(instruction->operands[i]).getUInt() == val)
+    {
+      m_position->nextBlock = instruction->blocks[i];
+      break;
+    }
+  }
 }
 
 INSTRUCTION(udiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t a = opA.getUInt(i);
@@ -1533,23 +2112,55 @@ INSTRUCTION(udiv)
   }
 }
 
-INSTRUCTION(uitofp)
+INSTRUCTION(uitofp)
+{
+  TypedValue op = getOperand(instruction->operands[0]);
+  for (unsigned i = 0; i < result.num; i++)
+  {
+    uint64_t in = op.getUInt(i);
+    if (result.size == 4)
+      result.setFloat(in ? (float)in : 0.f, i);
+    else
+      result.setFloat(in ? (double)in : 0.0, i);
+  }
+}
+
+INSTRUCTION(uniform)
+{
+  // The first work-item in the work-group to reach a uniform instruction
+  // computes its result for the rest of the work-group
+  if (m_uniformRegisters)
+  {
+    if (m_workGroup->skipUniform(instruction->resultID))
+      return;
+    result.data = m_values[instruction->resultID].data;
+  }
+
+  switch (instruction->uniformHandler)
+  {
+#define HANDLER_CASE(name)                    \
+  case HANDLER_##name:                        \
+    name<instrumented>(instruction, result);  \
+    break;
+  HANDLERS(HANDLER_CASE)
+#undef HANDLER_CASE
+  }
+}
+
+INSTRUCTION(unreachable)
+{
+  FATAL_ERROR("Encountered unreachable instruction");
+}
+
+INSTRUCTION(unsupported)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
-  for (unsigned i = 0; i < result.num; i++)
-  {
-    uint64_t in = op.getUInt(i);
-    if (result.size == 4)
-      result.setFloat(in ? (float)in : 0.f, i);
-    else
-      result.setFloat(in ? (double)in : 0.0, i);
-  }
+  FATAL_ERROR("Unsupported instruction: %s", instruction->inst->getOpcodeName());
 }
 
 INSTRUCTION(urem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction->operands[0]);
+  TypedValue opB = getOperand(instruction->operands[1]);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t a = opA.getUInt(i);
@@ -1560,13 +2171,60 @@ INSTRUCTION(urem)
 
 INSTRUCTION(zext)
 {
-  TypedValue operand = getOperand(instruction->getOperand(0));
+  TypedValue operand = getOperand(instruction->operands[0]);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(operand.getUInt(i), i);
   }
 }
 
+// Handlers specialised for a single element type, chosen when the
+// instruction is decoded, which operate directly on arrays of elements
+#define TYPED_BINARY_INSTRUCTION(name, T, Op)                    \
+  INSTRUCTION(name)                                              \
+  {                                                              \
+    TypedValue opA = getOperand(instruction->operands[0]);       \
+    TypedValue opB = getOperand(instruction->operands[1]);       \
+    applyElementwise<T>(result.data, opA.data, false,            \
+                        opB.data, false, result.num, Op());      \
+  }
+TYPED_BINARY_INSTRUCTION(add_i32, uint32_t, OpAdd)
+TYPED_BINARY_INSTRUCTION(add_i64, uint64_t, OpAdd)
+TYPED_BINARY_INSTRUCTION(bwand_i32, uint32_t, OpAnd)
+TYPED_BINARY_INSTRUCTION(bwand_i64, uint64_t, OpAnd)
+TYPED_BINARY_INSTRUCTION(bwor_i32, uint32_t, OpOr)
+TYPED_BINARY_INSTRUCTION(bwor_i64, uint64_t, OpOr)
+TYPED_BINARY_INSTRUCTION(bwxor_i32, uint32_t, OpXor)
+TYPED_BINARY_INSTRUCTION(bwxor_i64, uint64_t, OpXor)
+TYPED_BINARY_INSTRUCTION(fadd_f32, float, OpAdd)
+TYPED_BINARY_INSTRUCTION(fadd_f64, double, OpAdd)
+TYPED_BINARY_INSTRUCTION(fdiv_f32, float, OpDiv)
+TYPED_BINARY_INSTRUCTION(fdiv_f64, double, OpDiv)
+TYPED_BINARY_INSTRUCTION(fmul_f32, float, OpMulF)
+TYPED_BINARY_INSTRUCTION(fmul_f64, double, OpMulF)
+TYPED_BINARY_INSTRUCTION(fsub_f32, float, OpSub)
+TYPED_BINARY_INSTRUCTION(fsub_f64, double, OpSub)
+TYPED_BINARY_INSTRUCTION(mul_i32, uint32_t, OpMul)
+TYPED_BINARY_INSTRUCTION(mul_i64, uint64_t, OpMul)
+TYPED_BINARY_INSTRUCTION(sub_i32, uint32_t, OpSub)
+TYPED_BINARY_INSTRUCTION(sub_i64, uint64_t, OpSub)
+#undef TYPED_BINARY_INSTRUCTION
+
+#define TYPED_COMPARE_INSTRUCTION(name, compare)                 \
+  INSTRUCTION(name)                                              \
+  {                                                              \
+    llvm::CmpInst::Predicate pred =                              \
+      ((const llvm::CmpInst*)instruction->inst)->getPredicate(); \
+    TypedValue opA = getOperand(instruction->operands[0]);       \
+    TypedValue opB = getOperand(instruction->operands[1]);       \
+    compare(pred, result.data, opA.data, opB.data, result.num);  \
+  }
+TYPED_COMPARE_INSTRUCTION(fcmp_f32, compareFloats<float>)
+TYPED_COMPARE_INSTRUCTION(fcmp_f64, compareFloats<double>)
+TYPED_COMPARE_INSTRUCTION(icmp_i32, (compareInts<uint32_t,int32_t>))
+TYPED_COMPARE_INSTRUCTION(icmp_i64, (compareInts<uint64_t,int64_t>))
+#undef TYPED_COMPARE_INSTRUCTION
+
 #undef INSTRUCTION
 
 
@@ -1576,6 +2234,9 @@ INSTRUCTION(zext)
 
 InterpreterCache::InterpreterCache(llvm::Function *kernel)
 {
+  // Check for disabling type-specialised instruction handlers
+  m_typedHandlers = !checkEnv("OCLGRIND_GENERIC_HANDLERS");
+
   // TODO: Determine this number dynamically?
   m_valueIDs.reserve(1024);
 
@@ -1640,6 +2301,81 @@ InterpreterCache::InterpreterCache(llvm::Function *kernel)
       }
     }
   }
+
+  // Give constant expressions that can be evaluated ahead of use a value
+  // slot, and re-resolve the operands of any expressions that use them
+  map<const llvm::Value*, unsigned> scopes;
+  for (auto E = m_constExpressions.begin(); E != m_constExpressions.end(); E++)
+  {
+    classifyConstantExpr(E->first, scopes);
+  }
+  for (auto E = m_constExpressions.begin(); E != m_constExpressions.end(); E++)
+  {
+    Instruction& expr = E->second;
+    for (unsigned i = 0; i < expr.operands.size(); i++)
+      expr.operands[i] = decodeOperand(expr.inst->getOperand(i));
+  }
+
+  // Find instructions that produce the same result in every work-item
+  if (checkEnv("OCLGRIND_SKIP_UNIFORM"))
+    analyzeUniformity(kernel, processed);
+
+  // Lay out the register file, giving each value a fixed slot in program
+  // order, with extra staging slots for PHI nodes and constant expressions
+  m_registerFileSize = 0;
+  vector<const llvm::Value*> values(m_valueIDs.size());
+  for (auto V = m_valueIDs.begin(); V != m_valueIDs.end(); V++)
+  {
+    values[V->second] = V->first;
+  }
+  m_valueSlots.resize(values.size());
+  for (unsigned i = 0; i < values.size(); i++)
+  {
+    pair<unsigned,unsigned> size = getValueSize(values[i]);
+    ValueSlot& slot = m_valueSlots[i];
+    slot.size    = size.first;
+    slot.num     = size.second;
+    slot.offset  = allocateRegister(size.first*size.second);
+    slot.uniform = m_uniformValues.count(values[i]);
+    if (llvm::isa<llvm::PHINode>(values[i]))
+      m_phiOffsets[values[i]] = allocateRegister(size.first*size.second);
+  }
+  for (auto E = m_constExpressions.begin(); E != m_constExpressions.end(); E++)
+  {
+    if (hasValue(E->first))
+      E->second.resultOffset = m_valueSlots[getValueID(E->first)].offset;
+    else
+      E->second.resultOffset = allocateRegister(E->second.allocSize);
+  }
+
+  // Create blocks for all functions, so that branch targets can be resolved
+  set<llvm::Function*>::iterator F;
+  for (F = processed.begin(); F != processed.end(); F++)
+  {
+    for (auto B = (*F)->begin(); B != (*F)->end(); B++)
+    {
+      m_blocks[&*B].block = &*B;
+    }
+  }
+
+  // Decode instructions
+  unsigned index = 0;
+  for (F = processed.begin(); F != processed.end(); F++)
+  {
+    for (auto B = (*F)->begin(); B != (*F)->end(); B++)
+    {
+      Block& block = m_blocks[&*B];
+      block.instructions.resize(B->size());
+
+      unsigned i = 0;
+      for (auto I = B->begin(); I != B->end(); I++, i++)
+      {
+        block.instructions[i].block = &block;
+        block.instructions[i].index = index++;
+        decodeInstruction(&*I, block.instructions[i]);
+      }
+    }
+  }
 }
 
 InterpreterCache::~InterpreterCache()
@@ -1655,10 +2391,12 @@ InterpreterCache::~InterpreterCache()
   for (constExprItr  = m_constExpressions.begin();
        constExprItr != m_constExpressions.end(); constExprItr++)
   {
+    llvm::Instruction *inst =
+      const_cast<llvm::Instruction*>(constExprItr->second.inst);
 #if LLVM_VERSION < 50
-    delete constExprItr->second;
+    delete inst;
 #else
-    constExprItr->second->deleteValue();
+    inst->deleteValue();
 #endif
   }
 }
@@ -1723,6 +2461,17 @@ InterpreterCache::Builtin InterpreterCache::getBuiltin(
   return m_builtins.at(function);
 }
 
+const InterpreterCache::Block* InterpreterCache::getBlock(
+  const llvm::BasicBlock *block) const
+{
+  BlockMap::const_iterator itr = m_blocks.find(block);
+  if (itr == m_blocks.end())
+  {
+    FATAL_ERROR("Basic block not found in cache");
+  }
+  return &itr->second;
+}
+
 void InterpreterCache::addConstant(const llvm::Value *value)
 {
   // Check if constant already in cache
@@ -1752,7 +2501,126 @@ TypedValue InterpreterCache::getConstant(const llvm::Value *operand) const
   return itr->second;
 }
 
-const llvm::Instruction* InterpreterCache::getConstantExpr(
+bool InterpreterCache::hasConstant(const llvm::Value *operand) const
+{
+  return m_constants.count(operand);
+}
+
+// Scopes at which a constant expression can be evaluated ahead of use
+#define CONSTEXPR_LAZY      0
+#define CONSTEXPR_SHARED    1
+#define CONSTEXPR_WORK_ITEM 2
+
+unsigned InterpreterCache::classifyConstantExpr(
+  const llvm::Value *value, map<const llvm::Value*, unsigned>& scopes)
+{
+  if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(value))
+  {
+    // Local and private variables have different addresses in each
+    // work-group or work-item
+    unsigned addrSpace = var->getType()->getPointerAddressSpace();
+    if (addrSpace == AddrSpaceGlobal || addrSpace == AddrSpaceConstant)
+      return CONSTEXPR_SHARED;
+    return CONSTEXPR_WORK_ITEM;
+  }
+  if (m_constants.count(value))
+    return CONSTEXPR_SHARED;
+  if (!m_constExpressions.count(value))
+    return CONSTEXPR_LAZY;
+
+  auto itr = scopes.find(value);
+  if (itr != scopes.end())
+    return itr->second;
+
+  // Expressions that could trap are only evaluated when used
+  const llvm::ConstantExpr *expr = (const llvm::ConstantExpr*)value;
+  unsigned scope = expr->canTrap() ? CONSTEXPR_LAZY : CONSTEXPR_SHARED;
+  for (auto O = expr->op_begin(); O != expr->op_end() && scope; O++)
+  {
+    unsigned opScope = classifyConstantExpr(*O, scopes);
+    scope = opScope == CONSTEXPR_LAZY ? CONSTEXPR_LAZY : max(scope, opScope);
+  }
+  scopes[value] = scope;
+
+  // Operands have already been added, so this preserves dependency order
+  if (scope != CONSTEXPR_LAZY)
+  {
+    addValueID(value);
+    ConstExprEntry entry(value, &m_constExpressions.at(value));
+    if (scope == CONSTEXPR_SHARED)
+      m_sharedConstExprs.push_back(entry);
+    else
+      m_workItemConstExprs.push_back(entry);
+  }
+
+  return scope;
+}
+
+void InterpreterCache::evaluateConstantExprs(WorkItem *workItem) const
+{
+  // Operands are rewritten before any work-item begins executing
+  call_once(m_sharedConstExprsEvaluated, [this, workItem]
+  {
+    const_cast<InterpreterCache*>(this)->poolConstantExprs(workItem);
+  });
+
+  for (auto E = m_workItemConstExprs.begin();
+       E != m_workItemConstExprs.end(); E++)
+  {
+    TypedValue& result = workItem->m_values[getValueID(E->first)];
+    workItem->dispatch<false>(E->second, result);
+  }
+}
+
+void InterpreterCache::poolConstantExprs(WorkItem *workItem)
+{
+  if (m_sharedConstExprs.empty())
+    return;
+
+  // Evaluate expressions and add results to the constant pool
+  unordered_map<unsigned, TypedValue> pooled;
+  for (auto E = m_sharedConstExprs.begin(); E != m_sharedConstExprs.end(); E++)
+  {
+    unsigned id = getValueID(E->first);
+    TypedValue& result = workItem->m_values[id];
+    workItem->dispatch<false>(E->second, result);
+
+    TypedValue value = result.clone();
+    m_constants[E->first] = value;
+    pooled[id] = value;
+  }
+
+  // Replace uses of the evaluated expressions with the pooled constants
+  auto rewrite = [&pooled](Instruction& instruction)
+  {
+    for (auto O = instruction.operands.begin();
+         O != instruction.operands.end(); O++)
+    {
+      if (O->kind != Operand::VALUE)
+        continue;
+      auto itr = pooled.find(O->valueID);
+      if (itr != pooled.end())
+      {
+        O->kind     = Operand::CONSTANT;
+        O->constant = itr->second;
+      }
+    }
+  };
+  for (auto B = m_blocks.begin(); B != m_blocks.end(); B++)
+  {
+    for (auto I = B->second.instructions.begin();
+         I != B->second.instructions.end(); I++)
+    {
+      rewrite(*I);
+    }
+  }
+  for (auto E = m_constExpressions.begin(); E != m_constExpressions.end(); E++)
+  {
+    rewrite(E->second);
+  }
+}
+
+const InterpreterCache::Instruction* InterpreterCache::getConstantExpr(
   const llvm::Value *expr) const
 {
   ConstExprMap::const_iterator itr = m_constExpressions.find(expr);
@@ -1760,7 +2628,99 @@ const llvm::Instruction* InterpreterCache::getConstantExpr(
   {
     FATAL_ERROR("Constant expression not found in cache");
   }
-  return itr->second;
+  return &itr->second;
+}
+
+size_t InterpreterCache::allocateRegister(size_t size)
+{
+  if (!size)
+    return 0;
+
+  // Align slots so that vector and 64-bit values can be accessed directly
+  size_t align = size >= 16 ? 16 : 8;
+  size_t offset = (m_registerFileSize + align - 1) & ~(align - 1);
+  m_registerFileSize = offset + size;
+  return offset;
+}
+
+void InterpreterCache::analyzeUniformity(
+  const llvm::Function *kernel, const set<llvm::Function*>& functions)
+{
+  // Kernel arguments are the same for every work-item, as are constants
+  // and global variable addresses
+  for (auto A = kernel->arg_begin(); A != kernel->arg_end(); A++)
+  {
+    m_uniformValues.insert(&*A);
+  }
+
+  // Propagate uniformity through side-effect free instructions whose
+  // operands are all uniform, until nothing changes
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (auto F = functions.begin(); F != functions.end(); F++)
+    {
+      for (auto I = inst_begin(*F); I != inst_end(*F); I++)
+      {
+        if (m_uniformValues.count(&*I))
+          continue;
+
+        switch (I->getOpcode())
+        {
+        case llvm::Instruction::ExtractElement:
+        case llvm::Instruction::ExtractValue:
+        case llvm::Instruction::FCmp:
+        case llvm::Instruction::GetElementPtr:
+        case llvm::Instruction::ICmp:
+        case llvm::Instruction::InsertElement:
+        case llvm::Instruction::InsertValue:
+        case llvm::Instruction::Select:
+        case llvm::Instruction::ShuffleVector:
+          break;
+        case llvm::Instruction::Call:
+        {
+          // Work-group geometry queries
+          const llvm::CallInst *call = (const llvm::CallInst*)&*I;
+          const llvm::Function *callee =
+            (const llvm::Function*)call->getCalledValue()->stripPointerCasts();
+          BuiltinMap::const_iterator builtin = m_builtins.find(callee);
+          if (builtin == m_builtins.end())
+            continue;
+          const string& name = builtin->second.name;
+          if (name != "get_enqueued_local_size" &&
+              name != "get_global_offset" &&
+              name != "get_global_size" &&
+              name != "get_group_id" &&
+              name != "get_local_size" &&
+              name != "get_num_groups" &&
+              name != "get_work_dim")
+            continue;
+          break;
+        }
+        default:
+          if (!I->isBinaryOp() && !I->isCast())
+            continue;
+          break;
+        }
+
+        bool uniform = true;
+        for (auto O = I->value_op_begin(); O != I->value_op_end(); O++)
+        {
+          if (!llvm::isa<llvm::Constant>(*O) && !m_uniformValues.count(*O))
+          {
+            uniform = false;
+            break;
+          }
+        }
+        if (uniform)
+        {
+          m_uniformValues.insert(&*I);
+          changed = true;
+        }
+      }
+    }
+  }
 }
 
 unsigned InterpreterCache::addValueID(const llvm::Value *value)
@@ -1795,6 +2755,17 @@ bool InterpreterCache::hasValue(const llvm::Value *value) const
   return m_valueIDs.count(value);
 }
 
+size_t InterpreterCache::getRegisterFileSize() const
+{
+  return m_registerFileSize;
+}
+
+const InterpreterCache::ValueSlot& InterpreterCache::getValueSlot(
+  unsigned id) const
+{
+  return m_valueSlots[id];
+}
+
 void InterpreterCache::addOperand(const llvm::Value *operand)
 {
   // Resolve constants
@@ -1821,8 +2792,16 @@ void InterpreterCache::addOperand(const llvm::Value *operand)
       {
         addOperand(*O);
       }
-      m_constExpressions[expr] = getConstExprAsInstruction(expr);
+
+      // Decode instruction form of expression
       // TODO: Resolve actual value?
+      Instruction& instruction = m_constExpressions[expr];
+      instruction.block = NULL;
+      decodeInstruction(getConstExprAsInstruction(expr), instruction);
+
+      // Size the result like a value slot, which omits vec3 padding
+      pair<unsigned,unsigned> size = getValueSize(expr);
+      instruction.allocSize = size.first*size.second;
     }
   }
   else
@@ -1830,3 +2809,276 @@ void InterpreterCache::addOperand(const llvm::Value *operand)
     addValueID(operand);
   }
 }
+
+InterpreterCache::Operand InterpreterCache::decodeOperand(
+  const llvm::Value *value) const
+{
+  Operand operand;
+  operand.kind     = Operand::NONE;
+  operand.valueID  = 0;
+  operand.constant = {0, 0, NULL};
+  operand.expr     = NULL;
+
+  ConstantMap::const_iterator constItr = m_constants.find(value);
+  ConstExprMap::const_iterator exprItr = m_constExpressions.find(value);
+  ValueMap::const_iterator valueItr = m_valueIDs.find(value);
+  if (constItr != m_constants.end())
+  {
+    operand.kind     = Operand::CONSTANT;
+    operand.constant = constItr->second;
+  }
+  else if (valueItr != m_valueIDs.end())
+  {
+    // Includes constant expressions that are evaluated ahead of use
+    operand.kind    = Operand::VALUE;
+    operand.valueID = valueItr->second;
+  }
+  else if (exprItr != m_constExpressions.end())
+  {
+    operand.kind = Operand::CONSTEXPR;
+    operand.expr = &exprItr->second;
+  }
+
+  return operand;
+}
+
+// Compute the byte offset of an element within an aggregate type
+static size_t getAggregateOffset(const llvm::Type *type,
+                                 llvm::ArrayRef<unsigned int> indices)
+{
+  size_t offset = 0;
+  for (unsigned i = 0; i < indices.size(); i++)
+  {
+    if (type->isArrayTy())
+    {
+      type = type->getArrayElementType();
+      offset += getTypeSize(type) * indices[i];
+    }
+    else if (type->isStructTy())
+    {
+      offset += getStructMemberOffset((const llvm::StructType*)type,
+                                      indices[i]);
+      type = type->getStructElementType(indices[i]);
+    }
+    else
+    {
+      FATAL_ERROR("Unsupported aggregate type: %d", type->getTypeID())
+    }
+  }
+  return offset;
+}
+
+void InterpreterCache::decodeInstruction(const llvm::Instruction *inst,
+                                         Instruction& instruction) const
+{
+  instruction.inst      = inst;
+  instruction.handler   = WorkItem::getHandler(inst->getOpcode());
+  instruction.opcode    = inst->getOpcode();
+  instruction.immediate = 0;
+  instruction.addressSpace = 0;
+  instruction.alignment    = 1;
+  instruction.builtin      = NULL;
+
+  // Result slot and size
+  pair<unsigned,unsigned> resultSize = getValueSize(inst);
+  ValueMap::const_iterator valueItr = m_valueIDs.find(inst);
+  instruction.resultID   = valueItr != m_valueIDs.end() ? valueItr->second : -1;
+  instruction.resultSize = resultSize.first;
+  instruction.resultNum  = resultSize.second;
+  instruction.allocSize  = resultSize.first*resultSize.second;
+
+  // Results are written directly to the register file, except for PHI
+  // nodes which are staged until all PHIs in the block have executed
+  instruction.resultOffset = 0;
+  if (valueItr != m_valueIDs.end())
+  {
+    if (inst->getOpcode() == llvm::Instruction::PHI)
+      instruction.resultOffset = m_phiOffsets.at(inst);
+    else
+      instruction.resultOffset = m_valueSlots[valueItr->second].offset;
+  }
+
+  // Use a handler specialised for the element type where possible
+  if (m_typedHandlers)
+    instruction.handler = WorkItem::getTypedHandler(instruction.handler, inst);
+
+  // Uniform instructions are only executed once per work-group
+  instruction.uniformHandler = instruction.handler;
+  if (m_uniformValues.count(inst))
+    instruction.handler = HANDLER_uniform;
+
+  // Resolve operands
+  for (unsigned i = 0; i < inst->getNumOperands(); i++)
+  {
+    instruction.operands.push_back(decodeOperand(inst->getOperand(i)));
+  }
+
+  // Pre-compute instruction specific properties
+  switch (inst->getOpcode())
+  {
+  case llvm::Instruction::Alloca:
+  {
+    const llvm::AllocaInst *allocInst = (const llvm::AllocaInst*)inst;
+    instruction.immediate = getTypeSize(allocInst->getAllocatedType());
+    break;
+  }
+  case llvm::Instruction::Br:
+  {
+    // Store successors as [iffalse, iftrue] for conditional branches
+    for (unsigned i = inst->getNumOperands() == 1 ? 0 : 1;
+         i < inst->getNumOperands(); i++)
+    {
+      instruction.blocks.push_back(
+        getBlock((const llvm::BasicBlock*)inst->getOperand(i)));
+    }
+    break;
+  }
+  case llvm::Instruction::Call:
+  {
+    const llvm::CallInst *callInst = (const llvm::CallInst*)inst;
+    const llvm::Function *function =
+      (const llvm::Function*)callInst->getCalledValue()->stripPointerCasts();
+    if (function->isDeclaration())
+    {
+      instruction.builtin = &m_builtins.at(function);
+      break;
+    }
+
+    instruction.blocks.push_back(getBlock(&*function->begin()));
+    for (auto A = function->arg_begin(); A != function->arg_end(); A++)
+    {
+      size_t size = 0;
+      if (A->hasByValAttr())
+      {
+        size = getTypeSize(A->getType()->getPointerElementType());
+      }
+      instruction.argIDs.push_back(getValueID(&*A));
+      instruction.sizes.push_back(size);
+    }
+    break;
+  }
+  case llvm::Instruction::ExtractValue:
+  {
+    const llvm::ExtractValueInst *extract =
+      (const llvm::ExtractValueInst*)inst;
+    instruction.immediate =
+      getAggregateOffset(extract->getAggregateOperand()->getType(),
+                         extract->getIndices());
+    break;
+  }
+  case llvm::Instruction::GetElementPtr:
+  {
+    const llvm::GetElementPtrInst *gepInst =
+      (const llvm::GetElementPtrInst*)inst;
+    const llvm::Type *type = gepInst->getPointerOperandType();
+
+    // Compute element sizes for each index, and fold struct member offsets
+    for (unsigned i = 1; i < inst->getNumOperands(); i++)
+    {
+      if (type->isPointerTy())
+      {
+        type = type->getPointerElementType();
+        instruction.sizes.push_back(getTypeSize(type));
+      }
+      else if (type->isArrayTy())
+      {
+        type = type->getArrayElementType();
+        instruction.sizes.push_back(getTypeSize(type));
+      }
+      else if (type->isVectorTy())
+      {
+        type = type->getVectorElementType();
+        instruction.sizes.push_back(getTypeSize(type));
+      }
+      else if (type->isStructTy())
+      {
+        unsigned index =
+          ((const llvm::ConstantInt*)inst->getOperand(i))->getZExtValue();
+        instruction.immediate +=
+          getStructMemberOffset((const llvm::StructType*)type, index);
+        instruction.sizes.push_back(0);
+        type = type->getStructElementType(index);
+      }
+      else
+      {
+        FATAL_ERROR("Unsupported GEP base type: %d", type->getTypeID());
+      }
+    }
+    break;
+  }
+  case llvm::Instruction::InsertValue:
+  {
+    const llvm::InsertValueInst *insert = (const llvm::InsertValueInst*)inst;
+    instruction.immediate =
+      getAggregateOffset(insert->getAggregateOperand()->getType(),
+                         insert->getIndices());
+    break;
+  }
+  case llvm::Instruction::Load:
+  {
+    const llvm::LoadInst *loadInst = (const llvm::LoadInst*)inst;
+    const llvm::Value *opPtr = loadInst->getPointerOperand();
+    instruction.addressSpace = loadInst->getPointerAddressSpace();
+    instruction.alignment = loadInst->getAlignment();
+    if (!instruction.alignment)
+    {
+      instruction.alignment =
+        getTypeAlignment(opPtr->getType()->getPointerElementType());
+    }
+    break;
+  }
+  case llvm::Instruction::PHI:
+  {
+    const llvm::PHINode *phiNode = (const llvm::PHINode*)inst;
+    for (unsigned i = 0; i < phiNode->getNumIncomingValues(); i++)
+    {
+      instruction.blocks.push_back(getBlock(phiNode->getIncomingBlock(i)));
+    }
+    break;
+  }
+  case llvm::Instruction::SExt:
+  {
+    instruction.immediate =
+      inst->getOperand(0)->getType()->getPrimitiveSizeInBits();
+    break;
+  }
+  case llvm::Instruction::ShuffleVector:
+  {
+    const llvm::ShuffleVectorInst *shuffle =
+      (const llvm::ShuffleVectorInst*)inst;
+    for (unsigned i = 0; i < resultSize.second; i++)
+    {
+      instruction.mask.push_back(shuffle->getMaskValue(i));
+    }
+    break;
+  }
+  case llvm::Instruction::Store:
+  {
+    const llvm::StoreInst *storeInst = (const llvm::StoreInst*)inst;
+    const llvm::Value *opPtr = storeInst->getPointerOperand();
+    instruction.addressSpace = storeInst->getPointerAddressSpace();
+    instruction.alignment = storeInst->getAlignment();
+    if (!instruction.alignment)
+    {
+      instruction.alignment =
+        getTypeAlignment(opPtr->getType()->getPointerElementType());
+    }
+    break;
+  }
+  case llvm::Instruction::Switch:
+  {
+    // Operands are [condition, default, (value, successor)...]
+    instruction.operands.clear();
+    instruction.operands.push_back(decodeOperand(inst->getOperand(0)));
+    instruction.blocks.push_back(
+      getBlock((const llvm::BasicBlock*)inst->getOperand(1)));
+    for (unsigned i = 2; i < inst->getNumOperands(); i += 2)
+    {
+      instruction.operands.push_back(decodeOperand(inst->getOperand(i)));
+      instruction.blocks.push_back(
+        getBlock((const llvm::BasicBlock*)inst->getOperand(i+1)));
+    }
+    break;
+  }
+  }
+}
@@ -8,6 +8,8 @@
 
 #include "common.h"
 
+#include <mutex>
+
 namespace llvm
 {
   class BasicBlock;
@@ -51,44 +53,149 @@ namespace oclgrind
   class InterpreterCache
   {
   public:
+    struct Block;
+    struct Instruction;
+
     struct Builtin
     {
       BuiltinFunction function;
       std::string name, overload;
     };
 
+    // Pre-resolved instruction operand
+    struct Operand
+    {
+      enum {NONE, VALUE, CONSTANT, CONSTEXPR} kind;
+      unsigned valueID;
+      TypedValue constant;
+      const Instruction *expr;
+    };
+
+    // Pre-decoded instruction, ready for execution by a work-item
+    struct Instruction
+    {
+      const llvm::Instruction *inst;
+      unsigned handler;
+      const Block *block;
+      unsigned opcode;
+
+      // Position in program layout order, used to reconverge work-items
+      // running in lockstep
+      unsigned index;
+
+      // Handler for instructions with results shared by a whole work-group
+      unsigned uniformHandler;
+
+      // Result value slot and size, and register file offset for result
+      unsigned resultID;
+      unsigned resultSize, resultNum, allocSize;
+      size_t resultOffset;
+
+      std::vector<Operand> operands;
+
+      // Branch/switch targets, PHI incoming blocks, or callee entry block
+      std::vector<const Block*> blocks;
+
+      // Callee argument value IDs (for calls to non-builtin functions)
+      std::vector<unsigned> argIDs;
+
+      // GEP index strides, or byval argument sizes for calls
+      std::vector<size_t> sizes;
+
+      // Shuffle mask (-1 for undef elements)
+      std::vector<int> mask;
+
+      // Instruction specific constant (GEP/aggregate offset, alloca size,
+      // sext source width)
+      size_t immediate;
+
+      // Memory access properties
+      unsigned addressSpace, alignment;
+
+      const Builtin *builtin;
+    };
+
+    struct Block
+    {
+      const llvm::BasicBlock *block;
+      std::vector<Instruction> instructions;
+    };
+
+    // Location of a value in the work-item register file
+    struct ValueSlot
+    {
+      unsigned size, num;
+      size_t offset;
+      bool uniform;
+    };
+
     InterpreterCache(llvm::Function *kernel);
     ~InterpreterCache();
 
     void addBuiltin(const llvm::Function *function);
     Builtin getBuiltin(const llvm::Function *function) const;
 
+    const Block* getBlock(const llvm::BasicBlock *block) const;
+
     void addConstant(const llvm::Value *constant);
     TypedValue getConstant(const llvm::Value *operand) const;
-    const llvm::Instruction* getConstantExpr(const llvm::Value *expr) const;
+    const Instruction* getConstantExpr(const llvm::Value *expr) const;
+    void evaluateConstantExprs(WorkItem *workItem) const;
+    bool hasConstant(const llvm::Value *operand) const;
 
     unsigned addValueID(const llvm::Value *value);
     unsigned getValueID(const llvm::Value *value) const;
     unsigned getNumValues() const;
     bool hasValue(const llvm::Value *value) const;
 
+    size_t getRegisterFileSize() const;
+    const ValueSlot& getValueSlot(unsigned id) const;
+
   private:
     typedef std::unordered_map<const llvm::Value*, unsigned> ValueMap;
     typedef std::unordered_map<const llvm::Function*, Builtin> BuiltinMap;
     typedef std::unordered_map<const llvm::Value*, TypedValue> ConstantMap;
-    typedef std::unordered_map<const llvm::Value*, llvm::Instruction*>
-      ConstExprMap;
+    typedef std::unordered_map<const llvm::Value*, Instruction> ConstExprMap;
+    typedef std::unordered_map<const llvm::BasicBlock*, Block> BlockMap;
 
+    BlockMap m_blocks;
     BuiltinMap m_builtins;
+    std::set<const llvm::Value*> m_uniformValues;
+    bool m_typedHandlers;
     ConstantMap m_constants;
     ConstExprMap m_constExpressions;
     ValueMap m_valueIDs;
 
+    // Constant expressions evaluated ahead of use, in dependency order.
+    // Expressions that only depend on global addresses are evaluated once
+    // and moved into the constant pool, while those that depend on local or
+    // private addresses are evaluated by each work-item.
+    typedef std::pair<const llvm::Value*, const Instruction*> ConstExprEntry;
+    std::vector<ConstExprEntry> m_sharedConstExprs;
+    std::vector<ConstExprEntry> m_workItemConstExprs;
+    mutable std::once_flag m_sharedConstExprsEvaluated;
+
+    // Register file layout, including staging slots for PHI node results
+    std::vector<ValueSlot> m_valueSlots;
+    std::unordered_map<const llvm::Value*, size_t> m_phiOffsets;
+    size_t m_registerFileSize;
+
     void addOperand(const llvm::Value *value);
+    size_t allocateRegister(size_t size);
+    void analyzeUniformity(const llvm::Function *kernel,
+                           const std::set<llvm::Function*>& functions);
+    unsigned classifyConstantExpr(
+      const llvm::Value *value,
+      std::map<const llvm::Value*, unsigned>& scopes);
+    void poolConstantExprs(WorkItem *workItem);
+    Operand decodeOperand(const llvm::Value *value) const;
+    void decodeInstruction(const llvm::Instruction *inst,
+                           Instruction& instruction) const;
   };
 
   class WorkItem
   {
+    friend class InterpreterCache;
     friend class WorkItemBuiltins;
 
   public:
@@ -99,9 +206,12 @@ namespace oclgrind
              WorkGroup *workGroup, Size3 lid);
     virtual ~WorkItem();
 
+    bool atSamePosition(const WorkItem *other) const;
     void clearBarrier();
-    void dispatch(const llvm::Instruction *instruction, TypedValue& result);
-    void execute(const llvm::Instruction *instruction);
+    template<bool instrumented = true>
+    void dispatch(const InterpreterCache::Instruction *instruction,
+                  TypedValue& result);
+    void execute(const InterpreterCache::Instruction *instruction);
     const std::stack<const llvm::Instruction*>& getCallStack() const;
     const llvm::BasicBlock* getCurrentBlock() const;
     const llvm::Instruction* getCurrentInstruction() const;
@@ -116,12 +226,19 @@ namespace oclgrind
     const WorkGroup* getWorkGroup() const;
     void printExpression(std::string expr) const;
     bool printValue(const llvm::Value *value) const;
+    void reset(WorkGroup *workGroup, Size3 lid);
+    State run();
+    bool runsBefore(const WorkItem *other) const;
     State step();
+    static bool stepLanes(WorkItem *const *lanes, size_t numLanes);
+    void yield();
 
     // SPIR instructions
   private:
 #define INSTRUCTION(name) \
-  void name(const llvm::Instruction *instruction, TypedValue& result)
+  template<bool instrumented> \
+  void name(const InterpreterCache::Instruction *instruction, \
+            TypedValue& result)
     INSTRUCTION(add);
     INSTRUCTION(alloc);
     INSTRUCTION(ashr);
@@ -167,10 +284,43 @@ namespace oclgrind
     INSTRUCTION(swtch);
     INSTRUCTION(udiv);
     INSTRUCTION(uitofp);
+    INSTRUCTION(uniform);
+    INSTRUCTION(unreachable);
+    INSTRUCTION(unsupported);
     INSTRUCTION(urem);
     INSTRUCTION(zext);
+
+    // Handlers specialised for a single element type
+    INSTRUCTION(add_i32);
+    INSTRUCTION(add_i64);
+    INSTRUCTION(bwand_i32);
+    INSTRUCTION(bwand_i64);
+    INSTRUCTION(bwor_i32);
+    INSTRUCTION(bwor_i64);
+    INSTRUCTION(bwxor_i32);
+    INSTRUCTION(bwxor_i64);
+    INSTRUCTION(fadd_f32);
+    INSTRUCTION(fadd_f64);
+    INSTRUCTION(fcmp_f32);
+    INSTRUCTION(fcmp_f64);
+    INSTRUCTION(fdiv_f32);
+    INSTRUCTION(fdiv_f64);
+    INSTRUCTION(fmul_f32);
+    INSTRUCTION(fmul_f64);
+    INSTRUCTION(fsub_f32);
+    INSTRUCTION(fsub_f64);
+    INSTRUCTION(icmp_i32);
+    INSTRUCTION(icmp_i64);
+    INSTRUCTION(mul_i32);
+    INSTRUCTION(mul_i64);
+    INSTRUCTION(sub_i32);
+    INSTRUCTION(sub_i64);
 #undef INSTRUCTION
 
+    static unsigned getHandler(unsigned opcode);
+    static unsigned getTypedHandler(unsigned handler,
+                                    const llvm::Instruction *inst);
+
   private:
     typedef std::map<std::string,
                      std::pair<const llvm::Value*,
@@ -179,7 +329,7 @@ namespace oclgrind
     size_t m_globalIndex;
     Size3 m_globalID;
     Size3 m_localID;
-    TypedValueMap m_phiTemps;
+    std::vector< std::pair<unsigned,TypedValue> > m_phiTemps;
     VariableMap m_variables;
     const Context *m_context;
     const KernelInvocation *m_kernelInvocation;
@@ -188,16 +338,36 @@ namespace oclgrind
     mutable MemoryPool m_pool;
 
     State m_state;
+    bool m_yield;
+    bool m_instrumented;
     struct Position;
     Position *m_position;
 
     Memory* getMemory(unsigned int addrSpace) const;
 
-    // Store for instruction results and other operand values
+    TypedValue beginInstruction(const InterpreterCache::Instruction *instruction);
+    template<bool instrumented>
+    void endInstruction(const InterpreterCache::Instruction *instruction,
+                        TypedValue& result);
+    void advance();
+    template<bool instrumented> State interpret();
+
+    // Store for instruction results and other operand values, each of which
+    // points to a fixed slot in the register file
     std::vector<TypedValue> m_values;
+
+    // Register file, either owned by this work-item or shared with the rest
+    // of the work-group as a structure-of-arrays with one lane per work-item
+    unsigned char *m_registers;
+    unsigned char *m_ownRegisters;
+    unsigned char *m_uniformRegisters;
+    size_t m_lane;
+    size_t m_numLanes;
+    unsigned char* getRegister(size_t offset, size_t size) const;
+    void setRegisters(unsigned char *registers, size_t lane, size_t numLanes);
+    TypedValue getOperand(const InterpreterCache::Operand& operand) const;
     TypedValue getValue(const llvm::Value *key) const;
     bool hasValue(const llvm::Value *key) const;
-    void setValue(const llvm::Value *key, TypedValue value);
 
     const InterpreterCache *m_cache;
   };
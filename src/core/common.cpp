@@ -884,7 +884,8 @@ namespace oclgrind
 
   MemoryPool::~MemoryPool()
   {
-    for (auto itr = m_blocks.begin(); itr != m_blocks.end(); itr++)
+    reset();
+    for (auto itr = m_freeBlocks.begin(); itr != m_freeBlocks.end(); itr++)
     {
       delete[] *itr;
     }
@@ -900,7 +901,7 @@ namespace oclgrind
     {
       // Oversized buffers allocated separately from main pool
       unsigned char *buffer = new unsigned char[size];
-      m_blocks.push_back(buffer);
+      m_largeBlocks.push_back(buffer);
       return buffer;
     }
 
@@ -923,8 +924,15 @@ namespace oclgrind
     // Check if enough space in current block
     if (m_offset + size > m_blockSize)
     {
-      // Allocate new block
-      m_blocks.push_front(new unsigned char[m_blockSize]);
+      // Reuse a previously released block if possible
+      if (!m_freeBlocks.empty())
+      {
+        m_blocks.splice(m_blocks.begin(), m_freeBlocks, m_freeBlocks.begin());
+      }
+      else
+      {
+        m_blocks.push_front(new unsigned char[m_blockSize]);
+      }
       m_offset = 0;
     }
     uint8_t *buffer = m_blocks.front() + m_offset;
@@ -941,4 +949,18 @@ namespace oclgrind
     memcpy(dest.data, source.data, dest.size*dest.num);
     return dest;
   }
+
+  void MemoryPool::reset()
+  {
+    // Keep standard blocks for reuse, but release oversized buffers
+    for (auto itr = m_largeBlocks.begin(); itr != m_largeBlocks.end(); itr++)
+    {
+      delete[] *itr;
+    }
+    m_largeBlocks.clear();
+    m_freeBlocks.splice(m_freeBlocks.begin(), m_blocks);
+
+    // Force next allocation to take a new block
+    m_offset = m_blockSize;
+  }
 }
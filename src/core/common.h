@@ -235,10 +235,13 @@ namespace oclgrind
     ~MemoryPool();
     uint8_t* alloc(size_t size);
     TypedValue clone(const TypedValue& source);
+    void reset();
   private:
     size_t m_blockSize;
     size_t m_offset;
     std::list<uint8_t*> m_blocks;
+    std::list<uint8_t*> m_freeBlocks;
+    std::list<uint8_t*> m_largeBlocks;
   };
 
   // Pool allocator class for STL containers
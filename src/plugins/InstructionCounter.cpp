@@ -83,6 +83,15 @@ string InstructionCounter::getOpcodeName(unsigned opcode) const
   return llvm::Instruction::getOpcodeName(opcode);
 }
 
+unsigned InstructionCounter::getEventMask() const
+{
+  return Plugin::INSTRUCTION_EXECUTED |
+         Plugin::KERNEL_BEGIN |
+         Plugin::KERNEL_END |
+         Plugin::WORK_GROUP_BEGIN |
+         Plugin::WORK_GROUP_COMPLETE;
+}
+
 void InstructionCounter::instructionExecuted(
   const WorkItem *workItem, const llvm::Instruction *instruction,
   const TypedValue& result)
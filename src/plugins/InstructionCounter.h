@@ -30,6 +30,8 @@ namespace oclgrind
     virtual void workGroupBegin(const WorkGroup *workGroup) override;
     virtual void workGroupComplete(const WorkGroup *workGroup) override;
 
+    virtual unsigned getEventMask() const override;
+
   private:
     std::vector<size_t> m_instructionCounts;
     std::vector<size_t> m_memopBytes;
@@ -85,6 +85,14 @@ InteractiveDebugger::InteractiveDebugger(const Context *context)
   ADD_CMD("workitem",     "wi", workitem);
 }
 
+unsigned InteractiveDebugger::getEventMask() const
+{
+  return Plugin::INSTRUCTION_EXECUTED |
+         Plugin::KERNEL_BEGIN |
+         Plugin::KERNEL_END |
+         Plugin::LOG;
+}
+
 void InteractiveDebugger::instructionExecuted(
   const WorkItem *workItem, const llvm::Instruction *instruction,
   const TypedValue& result)
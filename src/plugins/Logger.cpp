@@ -60,6 +60,16 @@ Logger::~Logger()
   }
 }
 
+unsigned Logger::getEventMask() const
+{
+  return Plugin::LOG;
+}
+
+bool Logger::supportsParallelWorkItems() const
+{
+  return true;
+}
+
 void Logger::log(MessageType type, const char *message)
 {
   lock_guard<mutex> lock(logMutex);
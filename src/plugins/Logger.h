@@ -18,6 +18,9 @@ namespace oclgrind
 
     virtual void log(MessageType type, const char *message) override;
 
+    virtual unsigned getEventMask() const override;
+    virtual bool supportsParallelWorkItems() const override;
+
   private:
     std::ostream *m_log;
 
@@ -25,6 +25,22 @@ MemCheck::MemCheck(const Context *context)
 {
 }
 
+unsigned MemCheck::getEventMask() const
+{
+  return Plugin::INSTRUCTION_EXECUTED |
+         Plugin::MEMORY_ATOMIC_LOAD |
+         Plugin::MEMORY_ATOMIC_STORE |
+         Plugin::MEMORY_LOAD |
+         Plugin::MEMORY_MAP |
+         Plugin::MEMORY_STORE |
+         Plugin::MEMORY_UNMAP;
+}
+
+bool MemCheck::supportsParallelWorkItems() const
+{
+  return true;
+}
+
 void MemCheck::instructionExecuted(const WorkItem *workItem,
                                    const llvm::Instruction *instruction,
                                    const TypedValue& result)
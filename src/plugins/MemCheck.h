@@ -47,6 +47,9 @@ namespace oclgrind
     virtual void memoryUnmap(const Memory *memory, size_t address,
                              const void *ptr) override;
 
+    virtual unsigned getEventMask() const override;
+    virtual bool supportsParallelWorkItems() const override;
+
   private:
     void checkArrayAccess(const WorkItem *workItem,
                           const llvm::GetElementPtrInst *GEPI) const;
@@ -8,6 +8,8 @@
 
 #include "core/common.h"
 
+#include <algorithm>
+
 #include "core/Context.h"
 #include "core/KernelInvocation.h"
 #include "core/Memory.h"
@@ -19,23 +21,41 @@
 using namespace oclgrind;
 using namespace std;
 
-THREAD_LOCAL RaceDetector::WorkerState RaceDetector::m_state = {NULL};
+THREAD_LOCAL RaceDetector::WorkerState
+  RaceDetector::m_state = {NULL, NULL, NULL};
 
 #define STATE(workgroup) (m_state.groups->at(workgroup))
 
-// Use a bank of mutexes to reduce unnecessary synchronisation
-#define NUM_GLOBAL_MUTEXES 4096 // Must be power of two
-#define GLOBAL_MUTEX(buffer,offset) \
-  m_globalMutexes[buffer][offset & (NUM_GLOBAL_MUTEXES-1)]
+// Size (in bytes) of each independently locked region of a global buffer
+#define GLOBAL_SHARD_SIZE 4096
+
+// Largest buffer (in bytes) to use a dense work-group shadow for
+#define DENSE_SHADOW_LIMIT (64*1024)
 
 RaceDetector::RaceDetector(const Context *context)
  : Plugin(context)
 {
   m_kernelInvocation = NULL;
+  m_globalEpoch = 1;
 
   m_allowUniformWrites = !checkEnv("OCLGRIND_UNIFORM_WRITES");
 }
 
+unsigned RaceDetector::getEventMask() const
+{
+  return Plugin::KERNEL_BEGIN |
+         Plugin::KERNEL_END |
+         Plugin::MEMORY_ALLOCATED |
+         Plugin::MEMORY_ATOMIC_LOAD |
+         Plugin::MEMORY_ATOMIC_STORE |
+         Plugin::MEMORY_DEALLOCATED |
+         Plugin::MEMORY_LOAD |
+         Plugin::MEMORY_STORE |
+         Plugin::WORK_GROUP_BARRIER |
+         Plugin::WORK_GROUP_BEGIN |
+         Plugin::WORK_GROUP_COMPLETE;
+}
+
 void RaceDetector::kernelBegin(const KernelInvocation *kernelInvocation)
 {
   m_kernelInvocation = kernelInvocation;
@@ -48,12 +68,17 @@ void RaceDetector::kernelEnd(const KernelInvocation *kernelInvocation)
     logRace(race);
   kernelRaces.clear();
 
-  // Clear all global memory accesses
-  for (auto &buffer : m_globalAccesses)
+  // Discard all global memory accesses
+  if (++m_globalEpoch == 0)
   {
-    size_t sz = buffer.second.size();
-    buffer.second.clear();
-    buffer.second.resize(sz);
+    for (auto buffer : m_globalBuffers)
+    {
+      if (!buffer)
+        continue;
+      for (auto &record : buffer->records)
+        record.epoch = 0;
+    }
+    m_globalEpoch = 1;
   }
 
   m_kernelInvocation = NULL;
@@ -66,8 +91,13 @@ void RaceDetector::memoryAllocated(const Memory *memory, size_t address,
   size_t buffer = memory->extractBuffer(address);
   if (memory->getAddressSpace() == AddrSpaceGlobal)
   {
-    m_globalAccesses[buffer].resize(size);
-    m_globalMutexes[buffer] = new mutex[NUM_GLOBAL_MUTEXES];
+    if (buffer >= m_globalBuffers.size())
+      m_globalBuffers.resize(buffer+1, NULL);
+
+    GlobalBuffer *globalBuffer = new GlobalBuffer;
+    globalBuffer->records.resize(size, {0, AccessRecord()});
+    globalBuffer->shards = new mutex[size/GLOBAL_SHARD_SIZE + 1];
+    m_globalBuffers[buffer] = globalBuffer;
   }
 }
 
@@ -93,10 +123,9 @@ void RaceDetector::memoryDeallocated(const Memory *memory, size_t address)
   size_t buffer = memory->extractBuffer(address);
   if (memory->getAddressSpace() == AddrSpaceGlobal)
   {
-    m_globalAccesses.erase(buffer);
-
-    delete[] m_globalMutexes.at(buffer);
-    m_globalMutexes.erase(buffer);
+    delete[] m_globalBuffers[buffer]->shards;
+    delete m_globalBuffers[buffer];
+    m_globalBuffers[buffer] = NULL;
   }
 }
 
@@ -133,8 +162,7 @@ void RaceDetector::workGroupBarrier(const WorkGroup *workGroup, uint32_t flags)
 {
   if (flags & CLK_LOCAL_MEM_FENCE)
   {
-    syncWorkItems(workGroup->getLocalMemory(),
-                  STATE(workGroup), STATE(workGroup).wiLocal);
+    syncLocal(*STATE(workGroup).local);
   }
   if (flags & CLK_GLOBAL_MEM_FENCE)
   {
@@ -151,37 +179,81 @@ void RaceDetector::workGroupBegin(const WorkGroup *workGroup)
     m_state.groups = new unordered_map<const WorkGroup*,WorkGroupState>;
   }
 
+  // Shadows are kept for re-use by later work-groups and kernels
+  if (!m_state.shadow)
+  {
+    m_state.shadow = new Shadow;
+    m_state.localShadows = new vector<LocalShadow*>;
+  }
+
   // Initialize work-group state
   WorkGroupState& state = (*m_state.groups)[workGroup];
   Size3 wgsize = workGroup->getGroupSize();
   state.numWorkItems = wgsize.x*wgsize.y*wgsize.z;
 
-  // Re-use pool allocator for all access maps
-  AccessMap tmp(0, AccessMap::hasher(), AccessMap::key_equal(),
-                state.wgGlobal.get_allocator());
-  state.wiGlobal.resize(state.numWorkItems+1, tmp);
-  state.wiLocal.resize(state.numWorkItems+1, tmp);
+  state.wiGlobal.resize(state.numWorkItems+1);
+
+  if (m_state.localShadows->empty())
+  {
+    state.local = new LocalShadow;
+    state.local->epoch = 0;
+  }
+  else
+  {
+    state.local = m_state.localShadows->back();
+    m_state.localShadows->pop_back();
+  }
+  state.local->reset();
 }
 
 void RaceDetector::workGroupComplete(const WorkGroup *workGroup)
 {
   WorkGroupState& state = STATE(workGroup);
 
-  syncWorkItems(workGroup->getLocalMemory(), state, state.wiLocal);
+  syncLocal(*state.local);
   syncWorkItems(m_context->getGlobalMemory(), state, state.wiGlobal);
+  m_state.localShadows->push_back(state.local);
 
-  // Merge global accesses across kernel invocation
-  size_t group = workGroup->getGroupIndex();
+  // Merge global accesses across kernel invocation in address order, so
+  // that each shard is locked once for each run of addresses within it
+  vector<pair<size_t,AccessRecord*>> records;
+  records.reserve(state.wgGlobal.size());
   for (auto &record : state.wgGlobal)
+    records.push_back({record.first, &record.second});
+  sort(records.begin(), records.end());
+
+  const Memory *memory = m_context->getGlobalMemory();
+  size_t group = workGroup->getGroupIndex();
+  GlobalBuffer *globalBuffer = NULL;
+  size_t lockedBuffer = 0, lockedShard = 0;
+  unique_lock<mutex> lock;
+  for (auto &record : records)
   {
     size_t address = record.first;
-    size_t buffer = m_context->getGlobalMemory()->extractBuffer(address);
-    size_t offset = m_context->getGlobalMemory()->extractOffset(address);
+    size_t buffer = memory->extractBuffer(address);
+    size_t offset = memory->extractOffset(address);
+    size_t shard = offset / GLOBAL_SHARD_SIZE;
+    if (buffer >= m_globalBuffers.size() || !m_globalBuffers[buffer])
+      continue;
+    if (!globalBuffer || buffer != lockedBuffer || shard != lockedShard)
+    {
+      if (lock.owns_lock())
+        lock.unlock();
+      globalBuffer = m_globalBuffers[buffer];
+      lock = unique_lock<mutex>(globalBuffer->shards[shard]);
+      lockedBuffer = buffer;
+      lockedShard = shard;
+    }
 
-    lock_guard<mutex> lock(GLOBAL_MUTEX(buffer, offset));
+    GlobalRecord& global = globalBuffer->records[offset];
+    if (global.epoch != m_globalEpoch)
+    {
+      global.epoch = m_globalEpoch;
+      global.record = AccessRecord();
+    }
 
-    AccessRecord& a = record.second;
-    AccessRecord& b = m_globalAccesses.at(buffer)[offset];
+    AccessRecord& a = *record.second;
+    AccessRecord& b = global.record;
 
     // Check for races with previous accesses
     if (check(a.load,  b.store) && getAccessWorkGroup(b.store) != group)
@@ -264,6 +336,63 @@ void RaceDetector::insert(AccessRecord& record,
   }
 }
 
+void RaceDetector::insert(MemoryAccess slots[2],
+                          const MemoryAccess& access) const
+{
+  // Keep the first access, and the first made by a different entity
+  if (!slots[0].isSet() || slots[0].isAtomic())
+    slots[0] = access;
+  else if (!slots[0].hasSameEntity(access) &&
+           (!slots[1].isSet() || slots[1].isAtomic()))
+    slots[1] = access;
+}
+
+void RaceDetector::insert(RangeList& accesses, size_t address, size_t size,
+                          const MemoryAccess& access,
+                          const uint8_t *storeData) const
+{
+  // Find existing range, checking the most recent access first
+  AccessRange *range = NULL;
+  if (!accesses.ranges.empty() &&
+      accesses.ranges.back().address == address &&
+      accesses.ranges.back().size == size)
+  {
+    range = &accesses.ranges.back();
+  }
+  else
+  {
+    auto itr = accesses.index.find(RangeKey(address, size));
+    if (itr != accesses.index.end())
+    {
+      range = &accesses.ranges[itr->second];
+    }
+  }
+
+  // Ranges that partially overlap an existing range get their own entry
+  if (!range)
+  {
+    accesses.index[RangeKey(address, size)] = accesses.ranges.size();
+    accesses.ranges.push_back(AccessRange());
+    range = &accesses.ranges.back();
+    range->address = address;
+    range->size = size;
+  }
+
+  if (access.isLoad())
+  {
+    if (!range->load.isSet() || range->load.isAtomic())
+      range->load = access;
+  }
+  else if (access.isStore())
+  {
+    if (!range->store.isSet() || range->store.isAtomic())
+    {
+      range->store = access;
+      memcpy(range->storeData, storeData, size);
+    }
+  }
+}
+
 void RaceDetector::insertKernelRace(const Race& race)
 {
   lock_guard<mutex> lock(kernelRacesMutex);
@@ -363,6 +492,13 @@ void RaceDetector::registerAccess(const Memory *memory,
   // Construct access
   MemoryAccess access(workGroup, workItem, storeData != NULL, atomic);
 
+  if (addrSpace == AddrSpaceLocal)
+  {
+    registerLocalAccess(memory, *STATE(workGroup).local,
+                        address, size, access, storeData);
+    return;
+  }
+
   size_t index;
   if (workItem)
   {
@@ -372,57 +508,120 @@ void RaceDetector::registerAccess(const Memory *memory,
   }
   else
   {
-    index = STATE(workGroup).wiLocal.size() - 1;
+    index = STATE(workGroup).numWorkItems;
   }
 
-  AccessMap& accesess = (addrSpace == AddrSpaceGlobal) ?
-    STATE(workGroup).wiGlobal[index] :
-    STATE(workGroup).wiLocal[index];
+  RangeList& accesses = STATE(workGroup).wiGlobal[index];
+
+  // Natural-width accesses are recorded as a single range, and larger
+  // accesses (e.g. work-group copies) are split into fixed-size chunks
+  for (size_t offset = 0; offset < size; offset += MAX_RANGE_SIZE)
+  {
+    insert(accesses, address + offset, min(size-offset, (size_t)MAX_RANGE_SIZE),
+           access, storeData ? storeData + offset : NULL);
+  }
+}
+
+void RaceDetector::registerLocalAccess(const Memory *memory,
+                                       LocalShadow& shadow,
+                                       size_t address, size_t size,
+                                       MemoryAccess access,
+                                       const uint8_t *storeData)
+{
+  // Map each local buffer to a region of the shadow when first accessed
+  size_t buffer = memory->extractBuffer(address);
+  if (buffer >= shadow.bases.size())
+    shadow.bases.resize(buffer+1, SIZE_MAX);
+  if (shadow.bases[buffer] == SIZE_MAX)
+  {
+    shadow.bases[buffer] = shadow.size;
+    shadow.size += memory->getBuffer(address)->size;
+    if (shadow.records.size() < shadow.size)
+      shadow.records.resize(shadow.size);
+  }
 
+  size_t base = shadow.bases[buffer] + memory->extractOffset(address);
   for (size_t i = 0; i < size; i++)
   {
+    LocalRecord& record = shadow.records[base + i];
+    if (record.epoch != shadow.epoch)
+    {
+      record = LocalRecord();
+      record.epoch = shadow.epoch;
+    }
+
     if (storeData)
       access.setStoreData(storeData[i]);
 
-    insert(accesess[address+i], access);
+    // Check for races with accesses made since the last barrier
+    MemoryAccess *others[] = {access.isStore() ? record.load : NULL,
+                              record.store};
+    for (MemoryAccess *slots : others)
+    {
+      for (unsigned s = 0; slots && s < 2; s++)
+      {
+        if (check(access, slots[s]))
+        {
+          insertRace(shadow.races,
+                     {AddrSpaceLocal, address + i, access, slots[s]});
+          break;
+        }
+      }
+    }
+
+    insert(access.isStore() ? record.store : record.load, access);
   }
 }
 
+void RaceDetector::syncLocal(LocalShadow& shadow) const
+{
+  for (auto race : shadow.races)
+    logRace(race);
+  shadow.races.clear();
+  shadow.nextEpoch();
+}
+
 void RaceDetector::syncWorkItems(const Memory *memory,
                                  WorkGroupState& state,
-                                 vector<AccessMap>& accesses)
+                                 vector<RangeList>& accesses)
 {
-  AccessMap wgAccesses(0, AccessMap::hasher(), AccessMap::key_equal(),
-                       state.wgGlobal.get_allocator());
+  Shadow& wgAccesses = *m_state.shadow;
+  wgAccesses.reset();
 
+  unsigned addrSpace = memory->getAddressSpace();
   for (size_t i = 0; i < state.numWorkItems + 1; i++)
   {
     RaceList races;
-    for (auto &record : accesses[i])
+    for (auto &range : accesses[i].ranges)
     {
-      size_t address = record.first;
-
-      AccessRecord& a = record.second;
-      AccessRecord& b = wgAccesses[address];
-
-      if (check(a.load,  b.store))
-        insertRace(races, {memory->getAddressSpace(),address,a.load,b.store});
-      if (check(a.store, b.load))
-        insertRace(races, {memory->getAddressSpace(),address,a.store,b.load});
-      if (check(a.store, b.store))
-        insertRace(races, {memory->getAddressSpace(),address,a.store,b.store});
-
-      if (a.load.isSet())
-      {
-        insert(b, a.load);
-        if (memory->getAddressSpace() == AddrSpaceGlobal)
-          insert(state.wgGlobal[address], a.load);
-      }
-      if (a.store.isSet())
+      AccessRecord a = {range.load, range.store};
+      for (size_t offset = 0; offset < range.size; offset++)
       {
-        insert(b, a.store);
-        if (memory->getAddressSpace() == AddrSpaceGlobal)
-          insert(state.wgGlobal[address], a.store);
+        size_t address = range.address + offset;
+        if (a.store.isSet())
+          a.store.setStoreData(range.storeData[offset]);
+
+        AccessRecord& b = wgAccesses.get(memory, address);
+
+        if (check(a.load,  b.store))
+          insertRace(races, {addrSpace, address, a.load, b.store});
+        if (check(a.store, b.load))
+          insertRace(races, {addrSpace, address, a.store, b.load});
+        if (check(a.store, b.store))
+          insertRace(races, {addrSpace, address, a.store, b.store});
+
+        if (a.load.isSet())
+        {
+          insert(b, a.load);
+          if (addrSpace == AddrSpaceGlobal)
+            insert(state.wgGlobal[address], a.load);
+        }
+        if (a.store.isSet())
+        {
+          insert(b, a.store);
+          if (addrSpace == AddrSpaceGlobal)
+            insert(state.wgGlobal[address], a.store);
+        }
       }
     }
 
@@ -434,6 +633,84 @@ void RaceDetector::syncWorkItems(const Memory *memory,
   }
 }
 
+void RaceDetector::RangeList::clear()
+{
+  ranges.clear();
+  index.clear();
+}
+
+void RaceDetector::LocalShadow::nextEpoch()
+{
+  // Discard all accesses without touching the records
+  if (++epoch == 0)
+  {
+    for (auto &record : records)
+      record.epoch = 0;
+    epoch = 1;
+  }
+}
+
+void RaceDetector::LocalShadow::reset()
+{
+  bases.clear();
+  size = 0;
+  races.clear();
+  nextEpoch();
+}
+
+RaceDetector::Shadow::Shadow()
+{
+  m_epoch = 1;
+  m_lastBuffer = 0;
+  m_lastDense = NULL;
+}
+
+RaceDetector::AccessRecord& RaceDetector::Shadow::get(const Memory *memory,
+                                                      size_t address)
+{
+  size_t buffer = memory->extractBuffer(address);
+  if (buffer != m_lastBuffer)
+  {
+    const Memory::Buffer *b = memory->getBuffer(address);
+    if (b && b->size <= DENSE_SHADOW_LIMIT)
+    {
+      m_lastDense = &m_dense[buffer];
+      if (m_lastDense->size() < b->size)
+        m_lastDense->resize(b->size, {0, AccessRecord()});
+    }
+    else
+    {
+      m_lastDense = NULL;
+    }
+    m_lastBuffer = buffer;
+  }
+
+  if (!m_lastDense)
+    return m_sparse[address];
+
+  Entry& entry = (*m_lastDense)[memory->extractOffset(address)];
+  if (entry.epoch != m_epoch)
+  {
+    entry.epoch = m_epoch;
+    entry.record = AccessRecord();
+  }
+  return entry.record;
+}
+
+void RaceDetector::Shadow::reset()
+{
+  // Buffer sizes may differ between memories, so re-check on next access
+  m_lastBuffer = 0;
+  m_lastDense = NULL;
+  m_sparse.clear();
+
+  if (++m_epoch == 0)
+  {
+    m_dense.clear();
+    m_epoch = 1;
+  }
+}
+
 RaceDetector::MemoryAccess::MemoryAccess()
 {
   this->info = 0;
@@ -519,6 +796,13 @@ void RaceDetector::MemoryAccess::setStoreData(uint8_t data)
   this->storeData = data;
 }
 
+bool RaceDetector::MemoryAccess::hasSameEntity(
+  const RaceDetector::MemoryAccess& other) const
+{
+  return this->isWorkItem() == other.isWorkItem() &&
+         this->entity == other.entity;
+}
+
 bool RaceDetector::MemoryAccess::operator==(
   const RaceDetector::MemoryAccess& other) const
 {
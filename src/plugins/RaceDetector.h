@@ -47,6 +47,8 @@ namespace oclgrind
     virtual void workGroupBegin(const WorkGroup *workGroup) override;
     virtual void workGroupComplete(const WorkGroup *workGroup) override;
 
+    virtual unsigned getEventMask() const override;
+
   private:
     struct MemoryAccess
     {
@@ -82,6 +84,7 @@ namespace oclgrind
       MemoryAccess(const WorkGroup *workGroup, const WorkItem *workItem,
                    bool store, bool atomic);
 
+      bool hasSameEntity(const MemoryAccess& other) const;
       bool operator==(const MemoryAccess& other) const;
     };
     struct AccessRecord
@@ -97,21 +100,73 @@ namespace oclgrind
       PoolAllocator<std::pair<const size_t,AccessRecord>,8192>
       > AccessMap;
 
-    std::unordered_map<size_t,std::vector<AccessRecord>> m_globalAccesses;
-    std::map< size_t,std::mutex* > m_globalMutexes;
+    // Accesses made by a single entity between two barriers, recorded as one
+    // entry per access range rather than one per byte
+    static const unsigned MAX_RANGE_SIZE = 16;
+    struct AccessRange
+    {
+      size_t address;
+      size_t size;
+      MemoryAccess load;
+      MemoryAccess store;
+      uint8_t storeData[MAX_RANGE_SIZE];
+    };
+    // Ranges are indexed by address and size, so that accesses of
+    // different sizes to the same address each reuse their own range
+    typedef std::pair<size_t,size_t> RangeKey;
+    struct RangeKeyHash
+    {
+      size_t operator()(const RangeKey& key) const
+      {
+        return std::hash<size_t>()(key.first) ^ (key.second << 1);
+      }
+    };
+    struct RangeList
+    {
+      std::vector<AccessRange> ranges;
+      std::unordered_map<RangeKey,size_t,RangeKeyHash> index;
 
-    struct WorkGroupState
+      void clear();
+    };
+
+    // Byte-level accesses made by a work-group between two barriers
+    // Small buffers are shadowed densely and invalidated by advancing an
+    // epoch, while accesses to larger buffers are kept in a hash map
+    class Shadow
     {
-      size_t numWorkItems;
-      std::vector<AccessMap> wiLocal;
-      std::vector<AccessMap> wiGlobal;
-      AccessMap wgGlobal;
+    public:
+      Shadow();
+      AccessRecord& get(const Memory *memory, size_t address);
+      void reset();
+
+    private:
+      struct Entry
+      {
+        uint32_t epoch;
+        AccessRecord record;
+      };
+      uint32_t m_epoch;
+      std::unordered_map<size_t,std::vector<Entry>> m_dense;
+      std::unordered_map<size_t,AccessRecord> m_sparse;
+      size_t m_lastBuffer;
+      std::vector<Entry> *m_lastDense;
     };
-    struct WorkerState
+
+    // Accesses to each global buffer by completed work-groups
+    // Records from previous kernels are discarded by advancing an epoch, and
+    // each fixed-size shard of a buffer is guarded by its own mutex
+    struct GlobalRecord
     {
-      std::unordered_map<const WorkGroup*,WorkGroupState> *groups;
+      uint32_t epoch;
+      AccessRecord record;
     };
-    static THREAD_LOCAL WorkerState m_state;
+    struct GlobalBuffer
+    {
+      std::vector<GlobalRecord> records;
+      std::mutex *shards;
+    };
+    std::vector<GlobalBuffer*> m_globalBuffers;
+    uint32_t m_globalEpoch;
 
     struct Race
     {
@@ -121,6 +176,42 @@ namespace oclgrind
     };
     typedef std::list<Race> RaceList;
 
+    // Flat per-byte shadow of a work-group's local memory
+    // Accesses are checked as they are made, keeping the first access of
+    // each type and the first from any other entity since the last barrier
+    struct LocalRecord
+    {
+      uint32_t epoch;
+      MemoryAccess load[2];
+      MemoryAccess store[2];
+    };
+    struct LocalShadow
+    {
+      uint32_t epoch;
+      std::vector<LocalRecord> records;
+      std::vector<size_t> bases;
+      size_t size;
+      RaceList races;
+
+      void nextEpoch();
+      void reset();
+    };
+
+    struct WorkGroupState
+    {
+      size_t numWorkItems;
+      LocalShadow *local;
+      std::vector<RangeList> wiGlobal;
+      AccessMap wgGlobal;
+    };
+    struct WorkerState
+    {
+      std::unordered_map<const WorkGroup*,WorkGroupState> *groups;
+      Shadow *shadow;
+      std::vector<LocalShadow*> *localShadows;
+    };
+    static THREAD_LOCAL WorkerState m_state;
+
     bool m_allowUniformWrites;
     const KernelInvocation *m_kernelInvocation;
 
@@ -131,16 +222,23 @@ namespace oclgrind
 
     bool check(const MemoryAccess& a, const MemoryAccess& b) const;
     void insert(AccessRecord& record, const MemoryAccess& access) const;
+    void insert(MemoryAccess slots[2], const MemoryAccess& access) const;
+    void insert(RangeList& accesses, size_t address, size_t size,
+                const MemoryAccess& access, const uint8_t *storeData) const;
     void insertKernelRace(const Race& race);
     void insertRace(RaceList& races, const Race& race) const;
     void logRace(const Race& race) const;
+    void registerLocalAccess(const Memory *memory, LocalShadow& shadow,
+                             size_t address, size_t size,
+                             MemoryAccess access, const uint8_t *storeData);
     void registerAccess(const Memory *memory,
                         const WorkGroup *workGroup,
                         const WorkItem *workItem,
                         size_t address, size_t size, bool atomic,
                         const uint8_t *storeData = NULL);
+    void syncLocal(LocalShadow& shadow) const;
     void syncWorkItems(const Memory *memory,
                        WorkGroupState& state,
-                       std::vector<AccessMap>& accesses);
+                       std::vector<RangeList>& accesses);
   };
 }
@@ -18,6 +18,8 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Argument.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 
 #include "Uninitialized.h"
@@ -34,22 +36,62 @@ using namespace std;
 //}
 
 // Multiple mutexes to mitigate risk of unnecessary synchronisation in atomics
-#define NUM_ATOMIC_MUTEXES 64 // Must be power of two
+// Striped by full address, so atomics to different buffers rarely collide
+#define NUM_ATOMIC_MUTEXES 1024 // Must be power of two
 static std::mutex atomicShadowMutex[NUM_ATOMIC_MUTEXES];
-#define ATOMIC_MUTEX(offset) \
-  atomicShadowMutex[(((offset)>>2) & (NUM_ATOMIC_MUTEXES-1))]
+#define ATOMIC_MUTEX(address) \
+  atomicShadowMutex[(((address)>>2) & (NUM_ATOMIC_MUTEXES-1))]
 
-THREAD_LOCAL ShadowContext::WorkSpace ShadowContext::m_workSpace = {NULL, NULL, NULL, 0};
+THREAD_LOCAL ShadowContext::WorkSpace ShadowContext::m_workSpace =
+    {NULL, NULL, NULL, 0, NULL, NULL, 0};
+
+namespace
+{
+    // Allocate shadow values from a work-item's own pool while it runs, so
+    // that they stay valid if the work-item resumes on another thread
+    class WorkItemPoolScope
+    {
+        public:
+            WorkItemPoolScope(ShadowContext &context, ShadowWorkItem *workItem) :
+                m_context(context),
+                m_previous(context.setMemoryPool(workItem->getMemoryPool()))
+            {
+            }
+            ~WorkItemPoolScope()
+            {
+                m_context.setMemoryPool(m_previous);
+            }
+
+        private:
+            ShadowContext &m_context;
+            MemoryPool *m_previous;
+    };
+
+    // Provide a scratch pool for callbacks made outside of a work-item
+    class ScratchPoolScope
+    {
+        public:
+            ScratchPoolScope(ShadowContext &context) : m_context(context)
+            {
+                m_context.createMemoryPool();
+            }
+            ~ScratchPoolScope()
+            {
+                m_context.destroyMemoryPool();
+            }
+
+        private:
+            ShadowContext &m_context;
+    };
+}
 
 Uninitialized::Uninitialized(const Context *context)
  : Plugin(context), shadowContext(sizeof(size_t)==8 ? 32 : 16)
 {
-    shadowContext.createMemoryPool();
 }
 
 Uninitialized::~Uninitialized()
 {
-    shadowContext.destroyMemoryPool();
 }
 
 void Uninitialized::allocAndStoreShadowMemory(unsigned addrSpace, size_t address, TypedValue SM,
@@ -1012,12 +1054,31 @@ void Uninitialized::handleIntrinsicInstruction(const WorkItem *workItem, const l
     }
 }
 
+unsigned Uninitialized::getEventMask() const
+{
+    return Plugin::HOST_MEMORY_STORE |
+           Plugin::INSTRUCTION_EXECUTED |
+           Plugin::KERNEL_BEGIN |
+           Plugin::KERNEL_END |
+           Plugin::MEMORY_MAP |
+           Plugin::WORK_ITEM_BEGIN |
+           Plugin::WORK_ITEM_COMPLETE |
+           Plugin::WORK_GROUP_BEGIN |
+           Plugin::WORK_GROUP_COMPLETE;
+}
+
+bool Uninitialized::supportsParallelWorkItems() const
+{
+    return true;
+}
+
 void Uninitialized::hostMemoryStore(const Memory *memory,
                              size_t address, size_t size,
                              const uint8_t *storeData)
 {
     if(memory->getAddressSpace() == AddrSpaceGlobal)
     {
+        ScratchPoolScope pool(shadowContext);
         TypedValue v = ShadowContext::getCleanValue(size);
         allocAndStoreShadowMemory(AddrSpaceGlobal, address, v);
     }
@@ -1034,6 +1095,7 @@ void Uninitialized::instructionExecuted(const WorkItem *workItem,
 
     ShadowWorkItem *shadowWorkItem = shadowContext.getShadowWorkItem(workItem);
     ShadowValues *shadowValues = shadowWorkItem->getValues();
+    WorkItemPoolScope pool(shadowContext, shadowWorkItem);
 
     switch(instruction->getOpcode())
     {
@@ -1153,7 +1215,7 @@ void Uninitialized::instructionExecuted(const WorkItem *workItem,
             assert(!llvm::isa<const llvm::IntrinsicInst>(instruction) && "intrinsics are handled elsewhere");
 
             // Fresh values for function
-            ShadowFrame *values = shadowValues->createCleanShadowFrame();
+            ShadowFrame *values = shadowValues->createCleanShadowFrame(shadowContext.getValueIndex(function));
 
             llvm::Function::const_arg_iterator argItr;
             for (argItr = function->arg_begin(); argItr != function->arg_end(); argItr++)
@@ -1172,12 +1234,11 @@ void Uninitialized::instructionExecuted(const WorkItem *workItem,
                     size_t origShadowAddress = workItem->getOperand(Val).getPointer();
                     size_t newShadowAddress = workItem->getOperand(&*argItr).getPointer();
                     ShadowMemory *mem = shadowWorkItem->getPrivateMemory();
-                    unsigned char *origShadowData = (unsigned char*)mem->getPointer(origShadowAddress);
                     size_t size = getTypeSize(argItr->getType()->getPointerElementType());
 
                     // Set new shadow memory
                     TypedValue v = ShadowContext::getCleanValue(size);
-                    memcpy(v.data, origShadowData, size);
+                    mem->load(v.data, origShadowAddress, size);
                     allocAndStoreShadowMemory(AddrSpacePrivate, newShadowAddress, v, workItem);
                     values->setValue(&*argItr, ShadowContext::getCleanValue(&*argItr));
                 }
@@ -1729,6 +1790,8 @@ void Uninitialized::instructionExecuted(const WorkItem *workItem,
 void Uninitialized::kernelBegin(const KernelInvocation *kernelInvocation)
 {
     const Kernel *kernel = kernelInvocation->getKernel();
+    shadowContext.indexFunctions(kernel->getFunction());
+    ScratchPoolScope pool(shadowContext);
 
     // Initialise kernel arguments and global variables
     for (auto value = kernel->values_begin(); value != kernel->values_end(); value++)
@@ -1909,6 +1972,7 @@ void Uninitialized::memoryMap(const Memory *memory, size_t address,
 {
     if(!(flags & CL_MAP_READ))
     {
+        ScratchPoolScope pool(shadowContext);
         allocAndStoreShadowMemory(memory->getAddressSpace(), address + offset,
                 ShadowContext::getCleanValue(size));
     }
@@ -2026,10 +2090,9 @@ void Uninitialized::storeShadowMemory(unsigned addrSpace, size_t address, TypedV
 
 void Uninitialized::workItemBegin(const WorkItem *workItem)
 {
-    shadowContext.createMemoryPool();
-    shadowContext.allocateWorkItems();
     ShadowWorkItem *shadowWI = shadowContext.createShadowWorkItem(workItem);
     ShadowValues *shadowValues = shadowWI->getValues();
+    WorkItemPoolScope pool(shadowContext, shadowWI);
 
     for(auto value : m_deferredInit)
     {
@@ -2095,14 +2158,11 @@ void Uninitialized::workItemBegin(const WorkItem *workItem)
 void Uninitialized::workItemComplete(const WorkItem *workItem)
 {
     shadowContext.destroyShadowWorkItem(workItem);
-    shadowContext.freeWorkItems();
-    shadowContext.destroyMemoryPool();
 }
 
 void Uninitialized::workGroupBegin(const WorkGroup *workGroup)
 {
-    shadowContext.createMemoryPool();
-    shadowContext.allocateWorkGroups();
+    ScratchPoolScope pool(shadowContext);
     shadowContext.createShadowWorkGroup(workGroup);
 
     for(auto value : m_deferredInitGroup)
@@ -2131,12 +2191,10 @@ void Uninitialized::workGroupBegin(const WorkGroup *workGroup)
 void Uninitialized::workGroupComplete(const WorkGroup *workGroup)
 {
     shadowContext.destroyShadowWorkGroup(workGroup);
-    shadowContext.freeWorkGroups();
-    shadowContext.destroyMemoryPool();
 }
 
-ShadowFrame::ShadowFrame() :
-    m_values(new UnorderedTypedValueMap())
+ShadowFrame::ShadowFrame(const ShadowValueIndex *index) :
+    m_call(NULL), m_index(index), m_values(index->size()), m_otherValues(NULL)
 {
 #ifdef DUMP_SHADOW
     m_valuesList = new ValuesList();
@@ -2145,7 +2203,7 @@ ShadowFrame::ShadowFrame() :
 
 ShadowFrame::~ShadowFrame()
 {
-    delete m_values;
+    delete m_otherValues;
 #ifdef DUMP_SHADOW
     delete m_valuesList;
 #endif
@@ -2163,11 +2221,11 @@ void ShadowFrame::dump() const
     {
         if((*itr)->hasName())
         {
-            cout << "%" << (*itr)->getName().str() << ": " << m_values->at(*itr) << endl;
+            cout << "%" << (*itr)->getName().str() << ": " << *findValue(*itr) << endl;
         }
         else
         {
-            cout << "%" << dec << num++ << ": " << m_values->at(*itr) << endl;
+            cout << "%" << dec << num++ << ": " << *findValue(*itr) << endl;
         }
     }
 #else
@@ -2177,20 +2235,43 @@ void ShadowFrame::dump() const
     cout << "=======================" << endl;
 }
 
+const TypedValue* ShadowFrame::findValue(const llvm::Value *V) const
+{
+    ShadowValueIndex::const_iterator itr = m_index->find(V);
+    if(itr != m_index->end())
+    {
+        const TypedValue *value = &m_values[itr->second];
+        return value->data ? value : NULL;
+    }
+    else if(m_otherValues)
+    {
+        // Values that do not belong to the function (e.g. local variables)
+        UnorderedTypedValueMap::const_iterator otherItr = m_otherValues->find(V);
+        if(otherItr != m_otherValues->end())
+        {
+            return &otherItr->second;
+        }
+    }
+
+    return NULL;
+}
+
 TypedValue ShadowFrame::getValue(const llvm::Value *V) const
 {
     if (llvm::isa<llvm::Instruction>(V)) {
-        // For instructions the shadow is already stored in the map.
-        assert(m_values->count(V) && "No shadow for instruction value");
-        return m_values->at(V);
+        // For instructions the shadow is already stored in the frame.
+        const TypedValue *value = findValue(V);
+        assert(value && "No shadow for instruction value");
+        return *value;
     }
     else if (llvm::isa<llvm::UndefValue>(V)) {
         return ShadowContext::getPoisonedValue(V);
     }
     else if (llvm::isa<llvm::Argument>(V)) {
-        // For arguments the shadow is already stored in the map.
-        assert(m_values->count(V) && "No shadow for argument value");
-        return m_values->at(V);
+        // For arguments the shadow is already stored in the frame.
+        const TypedValue *value = findValue(V);
+        assert(value && "No shadow for argument value");
+        return *value;
     }
     else if(const llvm::ConstantVector *VC = llvm::dyn_cast<llvm::ConstantVector>(V))
     {
@@ -2216,7 +2297,7 @@ TypedValue ShadowFrame::getValue(const llvm::Value *V) const
 void ShadowFrame::setValue(const llvm::Value *V, TypedValue SV)
 {
 #ifdef DUMP_SHADOW
-    if(!m_values->count(V))
+    if(!findValue(V))
     {
         m_valuesList->push_back(V);
     }
@@ -2225,13 +2306,25 @@ void ShadowFrame::setValue(const llvm::Value *V, TypedValue SV)
         cout << "Shadow for value " << V->getName().str() << " reset!" << endl;
     }
 #endif
-    (*m_values)[V] = SV;
+    ShadowValueIndex::const_iterator itr = m_index->find(V);
+    if(itr != m_index->end())
+    {
+        m_values[itr->second] = SV;
+    }
+    else
+    {
+        if(!m_otherValues)
+        {
+            m_otherValues = new UnorderedTypedValueMap();
+        }
+        (*m_otherValues)[V] = SV;
+    }
 }
 
-ShadowValues::ShadowValues() :
+ShadowValues::ShadowValues(const ShadowValueIndex *index) :
     m_stack(new ShadowValuesStack())
 {
-    pushFrame(createCleanShadowFrame());
+    pushFrame(createCleanShadowFrame(index));
 }
 
 ShadowValues::~ShadowValues()
@@ -2244,13 +2337,13 @@ ShadowValues::~ShadowValues()
     delete m_stack;
 }
 
-ShadowFrame* ShadowValues::createCleanShadowFrame()
+ShadowFrame* ShadowValues::createCleanShadowFrame(const ShadowValueIndex *index)
 {
-    return new ShadowFrame();
+    return new ShadowFrame(index);
 }
 
-ShadowWorkItem::ShadowWorkItem(unsigned bufferBits) :
-    m_memory(new ShadowMemory(AddrSpacePrivate, bufferBits)), m_values(new ShadowValues())
+ShadowWorkItem::ShadowWorkItem(unsigned bufferBits, const ShadowValueIndex *index) :
+    m_memory(new ShadowMemory(AddrSpacePrivate, bufferBits)), m_values(new ShadowValues(index))
 {
 }
 
@@ -2260,17 +2353,56 @@ ShadowWorkItem::~ShadowWorkItem()
     delete m_values;
 }
 
-ShadowWorkGroup::ShadowWorkGroup(unsigned bufferBits) :
+ShadowWorkGroup::ShadowWorkGroup(unsigned bufferBits, size_t numWorkItems) :
     //FIXME: Hard coded values
-    m_memory(new ShadowMemory(AddrSpaceLocal, sizeof(size_t) == 8 ? 16 : 8))
+    m_memory(new ShadowMemory(AddrSpaceLocal, sizeof(size_t) == 8 ? 16 : 8)),
+    m_workItems(numWorkItems, NULL)
 {
 }
 
 ShadowWorkGroup::~ShadowWorkGroup()
 {
+    for(auto workItem : m_workItems)
+    {
+        delete workItem;
+    }
     delete m_memory;
 }
 
+ShadowMemory::Buffer::Buffer(size_t size) :
+    size(size), flags(0)
+{
+    size_t numWords = (size + 63) / 64;
+    poisoned = new std::atomic<uint64_t>[numWords]();
+    partialChunks = new std::atomic<uint64_t>[(numWords + 63) / 64]();
+}
+
+ShadowMemory::Buffer::~Buffer()
+{
+    delete[] poisoned;
+    delete[] partialChunks;
+}
+
+// Check whether any byte in a range may be only partially defined
+static bool hasPartialBytes(const ShadowMemory::Buffer *buffer, size_t offset, size_t size)
+{
+    if(size == 0)
+    {
+        return false;
+    }
+
+    for(size_t chunk = offset/64; chunk <= (offset+size-1)/64; chunk++)
+    {
+        uint64_t flags = buffer->partialChunks[chunk/64].load(std::memory_order_acquire);
+        if((flags >> (chunk%64)) & 1)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 ShadowMemory::ShadowMemory(AddressSpace addrSpace, unsigned bufferBits) :
     m_addrSpace(addrSpace), m_map(), m_numBitsAddress((sizeof(size_t)<<3) - bufferBits), m_numBitsBuffer(bufferBits)
 {
@@ -2285,65 +2417,65 @@ void ShadowMemory::allocate(size_t address, size_t size)
 {
     size_t index = extractBuffer(address);
 
-    if(m_map.count(index))
+    std::lock_guard<std::mutex> lock(m_allocMutex);
+
+    if(index >= m_map.size())
     {
-        deallocate(address);
+        m_map.resize(index+1, NULL);
     }
 
-    Buffer *buffer = new Buffer();
-    buffer->size   = size;
-    buffer->flags  = 0;
-    buffer->data   = new unsigned char[size];
-
-    m_map[index] = buffer;
+    delete m_map[index];
+    m_map[index] = new Buffer(size);
 }
 
 void ShadowMemory::clear()
 {
-    MemoryMap::iterator mItr;
-    for(mItr = m_map.begin(); mItr != m_map.end(); ++mItr)
+    for(auto buffer : m_map)
     {
-        delete[] mItr->second->data;
-        delete mItr->second;
+        delete buffer;
     }
+    m_map.clear();
 }
 
 void ShadowMemory::deallocate(size_t address)
 {
     size_t index = extractBuffer(address);
 
-    assert(m_map.count(index) && "Cannot deallocate non existing memory!");
+    std::lock_guard<std::mutex> lock(m_allocMutex);
+
+    assert(index < m_map.size() && m_map[index] &&
+           "Cannot deallocate non existing memory!");
 
-    delete[] m_map.at(index)->data;
-    delete m_map.at(index);
-    m_map.at(index) = NULL;
+    delete m_map[index];
+    m_map[index] = NULL;
 }
 
 void ShadowMemory::dump() const
 {
     cout << "====== ShadowMem (" << getAddressSpaceName(m_addrSpace) << ") ======";
 
-    for(unsigned b = 0, o = 1; b < m_map.size(); o++)
+    for(size_t b = 1; b < m_map.size(); b++)
     {
-        if(!m_map.count(b+o))
+        if(!m_map[b])
         {
             continue;
         }
 
-        for(unsigned i = 0; i < m_map.at(b+o)->size; i++)
+        for(unsigned i = 0; i < m_map[b]->size; i++)
         {
+            size_t address = (b<<m_numBitsAddress) | i;
             if (i%4 == 0)
             {
                 cout << endl << hex << uppercase
                     << setw(16) << setfill(' ') << right
-                    << ((((size_t)b+o)<<m_numBitsAddress) | i) << ":";
+                    << address << ":";
             }
+
+            unsigned char shadow;
+            load(&shadow, address);
             cout << " " << hex << uppercase << setw(2) << setfill('0')
-                << (int)m_map.at(b+o)->data[i];
+                << (int)shadow;
         }
-
-        ++b;
-        o = 0;
     }
     cout << endl;
 
@@ -2360,21 +2492,12 @@ size_t ShadowMemory::extractOffset(size_t address) const
     return (address & (((size_t)-1) >> m_numBitsBuffer));
 }
 
-void* ShadowMemory::getPointer(size_t address) const
-{
-    size_t index = extractBuffer(address);
-    size_t offset= extractOffset(address);
-
-    assert(m_map.count(index) && "No shadow memory found!");
-
-    return m_map.at(index)->data + offset;
-}
-
 bool ShadowMemory::isAddressValid(size_t address, size_t size) const
 {
     size_t index = extractBuffer(address);
     size_t offset = extractOffset(address);
-    return m_map.count(index) && (offset + size <= m_map.at(index)->size);
+    return index < m_map.size() && m_map[index] &&
+           (offset + size <= m_map[index]->size);
 }
 
 void ShadowMemory::load(unsigned char *dst, size_t address, size_t size) const
@@ -2384,8 +2507,27 @@ void ShadowMemory::load(unsigned char *dst, size_t address, size_t size) const
 
     if(isAddressValid(address, size))
     {
-        assert(m_map.count(index) && "No shadow memory found!");
-        memcpy(dst, m_map.at(index)->data + offset, size);
+        Buffer *buffer = m_map[index];
+
+        for(size_t i = 0; i < size; i++)
+        {
+            size_t byte = offset + i;
+            uint64_t word = buffer->poisoned[byte/64].load(std::memory_order_relaxed);
+            dst[i] = ((word >> (byte%64)) & 1) ? 0xFF : 0x00;
+        }
+
+        if(hasPartialBytes(buffer, offset, size))
+        {
+            std::lock_guard<std::mutex> lock(buffer->partialMutex);
+            for(size_t i = 0; i < size; i++)
+            {
+                auto itr = buffer->partial.find(offset + i);
+                if(itr != buffer->partial.end())
+                {
+                    dst[i] = itr->second;
+                }
+            }
+        }
     }
     else
     {
@@ -2396,8 +2538,7 @@ void ShadowMemory::load(unsigned char *dst, size_t address, size_t size) const
 
 void ShadowMemory::lock(size_t address) const
 {
-    size_t offset = extractOffset(address);
-    ATOMIC_MUTEX(offset).lock();
+    ATOMIC_MUTEX(address).lock();
 }
 
 void ShadowMemory::store(const unsigned char *src, size_t address, size_t size)
@@ -2407,41 +2548,83 @@ void ShadowMemory::store(const unsigned char *src, size_t address, size_t size)
 
     if(isAddressValid(address, size))
     {
-        assert(m_map.count(index) && "Cannot store to unallocated memory!");
-        memcpy(m_map.at(index)->data + offset, src, size);
+        Buffer *buffer = m_map[index];
+
+        // Update the bits of each 64-byte chunk with at most two atomics
+        bool partial = false;
+        size_t i = 0;
+        while(i < size)
+        {
+            size_t word = (offset + i) / 64;
+            uint64_t set = 0, unset = 0;
+            for(; i < size && (offset + i) / 64 == word; i++)
+            {
+                uint64_t bit = (uint64_t)1 << ((offset + i) % 64);
+                if(src[i] == 0xFF)
+                {
+                    set |= bit;
+                }
+                else
+                {
+                    unset |= bit;
+                    partial |= (src[i] != 0x00);
+                }
+            }
+
+            if(set)
+            {
+                buffer->poisoned[word].fetch_or(set, std::memory_order_relaxed);
+            }
+            if(unset)
+            {
+                buffer->poisoned[word].fetch_and(~unset, std::memory_order_relaxed);
+            }
+        }
+
+        // Record partially defined bytes, and drop any that were overwritten
+        if(partial || hasPartialBytes(buffer, offset, size))
+        {
+            std::lock_guard<std::mutex> lock(buffer->partialMutex);
+            for(i = 0; i < size; i++)
+            {
+                size_t byte = offset + i;
+                if(src[i] == 0x00 || src[i] == 0xFF)
+                {
+                    buffer->partial.erase(byte);
+                }
+                else
+                {
+                    buffer->partial[byte] = src[i];
+
+                    size_t chunk = byte / 64;
+                    buffer->partialChunks[chunk/64].fetch_or((uint64_t)1 << (chunk%64),
+                                                             std::memory_order_release);
+                }
+            }
+        }
     }
 }
 
 void ShadowMemory::unlock(size_t address) const
 {
-    size_t offset = extractOffset(address);
-    ATOMIC_MUTEX(offset).unlock();
+    ATOMIC_MUTEX(address).unlock();
 }
 
 ShadowContext::ShadowContext(unsigned bufferBits) :
-    m_globalMemory(new ShadowMemory(AddrSpaceGlobal, bufferBits)), m_globalValues(), m_numBitsBuffer(bufferBits)
+    m_globalMemory(new ShadowMemory(AddrSpaceGlobal, bufferBits)), m_globalValues(), m_kernelIndex(NULL), m_numBitsBuffer(bufferBits), m_generation(0)
 {
 }
 
 ShadowContext::~ShadowContext()
 {
-    delete m_globalMemory;
-}
-
-void ShadowContext::allocateWorkItems()
-{
-    if(!m_workSpace.workItems)
+    for(unsigned i = 0; i < NUM_GROUP_SHARDS; i++)
     {
-        m_workSpace.workItems = new ShadowItemMap();
-    }
-}
-
-void ShadowContext::allocateWorkGroups()
-{
-    if(!m_workSpace.workGroups)
-    {
-        m_workSpace.workGroups = new ShadowGroupMap();
+        for(auto group : m_groupShards[i].workGroups)
+        {
+            delete group.second;
+        }
     }
+    delete m_globalMemory;
 }
 
 void ShadowContext::clearGlobalValues()
@@ -2453,25 +2636,33 @@ void ShadowContext::createMemoryPool()
 {
     if(m_workSpace.poolUsers == 0)
     {
-        m_workSpace.memoryPool = new MemoryPool();
+        m_workSpace.scratchPool = new MemoryPool();
     }
 
     ++m_workSpace.poolUsers;
+    m_workSpace.memoryPool = m_workSpace.scratchPool;
 }
 
 ShadowWorkItem* ShadowContext::createShadowWorkItem(const WorkItem *workItem)
 {
-    assert(!m_workSpace.workItems->count(workItem) && "Workitems may only have one shadow");
-    ShadowWorkItem *sWI = new ShadowWorkItem(m_numBitsBuffer);
-    (*m_workSpace.workItems)[workItem] = sWI;
+    ShadowWorkGroup *sWG = getShadowWorkGroup(workItem->getWorkGroup());
+    size_t index = getLocalIndex(workItem);
+    assert(!sWG->getShadowWorkItem(index) && "Workitems may only have one shadow");
+    ShadowWorkItem *sWI = new ShadowWorkItem(m_numBitsBuffer, m_kernelIndex);
+    sWG->setShadowWorkItem(index, sWI);
     return sWI;
 }
 
 ShadowWorkGroup* ShadowContext::createShadowWorkGroup(const WorkGroup *workGroup)
 {
-    assert(!m_workSpace.workGroups->count(workGroup) && "Workgroups may only have one shadow");
-    ShadowWorkGroup *sWG = new ShadowWorkGroup(m_numBitsBuffer);
-    (*m_workSpace.workGroups)[workGroup] = sWG;
+    Size3 groupSize = workGroup->getGroupSize();
+    ShadowWorkGroup *sWG = new ShadowWorkGroup(m_numBitsBuffer,
+            groupSize.x*groupSize.y*groupSize.z);
+
+    GroupShard& shard = getGroupShard(workGroup);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    assert(!shard.workGroups.count(workGroup) && "Workgroups may only have one shadow");
+    shard.workGroups[workGroup] = sWG;
     return sWG;
 }
 
@@ -2481,48 +2672,42 @@ void ShadowContext::destroyMemoryPool()
 
     if(m_workSpace.poolUsers == 0)
     {
-        delete m_workSpace.memoryPool;
+        delete m_workSpace.scratchPool;
+        m_workSpace.scratchPool = NULL;
+        m_workSpace.memoryPool = NULL;
     }
 }
 
 void ShadowContext::destroyShadowWorkItem(const WorkItem *workItem)
 {
-    assert(m_workSpace.workItems->count(workItem) && "No shadow for workitem found!");
-    delete (*m_workSpace.workItems)[workItem];
-    m_workSpace.workItems->erase(workItem);
+    ShadowWorkGroup *sWG = getShadowWorkGroup(workItem->getWorkGroup());
+    size_t index = getLocalIndex(workItem);
+    assert(sWG->getShadowWorkItem(index) && "No shadow for workitem found!");
+    delete sWG->getShadowWorkItem(index);
+    sWG->setShadowWorkItem(index, NULL);
 }
 
 void ShadowContext::destroyShadowWorkGroup(const WorkGroup *workGroup)
 {
-    assert(m_workSpace.workGroups->count(workGroup) && "No shadow for workgroup found!");
-    delete (*m_workSpace.workGroups)[workGroup];
-    m_workSpace.workGroups->erase(workGroup);
+    GroupShard& shard = getGroupShard(workGroup);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    assert(shard.workGroups.count(workGroup) && "No shadow for workgroup found!");
+    delete shard.workGroups[workGroup];
+    shard.workGroups.erase(workGroup);
+
+    // Invalidate the work-group shadows cached by each thread
+    m_generation.fetch_add(1, std::memory_order_release);
 }
 
 void ShadowContext::dump(const WorkItem *workItem) const
 {
     dumpGlobalValues();
     m_globalMemory->dump();
-    if(m_workSpace.workGroups && m_workSpace.workGroups->size())
+    if(workItem)
     {
-        m_workSpace.workGroups->begin()->second->dump();
-    }
-    if(m_workSpace.workItems && m_workSpace.workItems->size())
-    {
-        if(workItem)
-        {
-            cout << "Item " << workItem->getGlobalID() << endl;
-            getShadowWorkItem(workItem)->dump();
-        }
-        else
-        {
-            ShadowItemMap::const_iterator itr;
-            for(itr = m_workSpace.workItems->begin(); itr != m_workSpace.workItems->end(); ++itr)
-            {
-                cout << "Item " << itr->first->getGlobalID() << endl;
-                itr->second->dump();
-            }
-        }
+        getShadowWorkGroup(workItem->getWorkGroup())->dump();
+        cout << "Item " << workItem->getGlobalID() << endl;
+        getShadowWorkItem(workItem)->dump();
     }
 }
 
@@ -2548,22 +2733,37 @@ void ShadowContext::dumpGlobalValues() const
     cout << "=======================" << endl;
 }
 
-void ShadowContext::freeWorkItems()
+ShadowWorkGroup* ShadowContext::findShadowWorkGroup(const WorkGroup *workGroup) const
 {
-    if(m_workSpace.workItems && !m_workSpace.workItems->size())
+    // Read the generation first, so that a concurrent invalidation is not missed
+    uint64_t generation = m_generation.load(std::memory_order_acquire);
+
+    ShadowWorkGroup *sWG;
     {
-        delete m_workSpace.workItems;
-        m_workSpace.workItems = NULL;
+        GroupShard& shard = getGroupShard(workGroup);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        assert(shard.workGroups.count(workGroup) && "No shadow for workgroup found!");
+        sWG = shard.workGroups.at(workGroup);
     }
+
+    m_workSpace.context = this;
+    m_workSpace.workGroup = workGroup;
+    m_workSpace.shadowWorkGroup = sWG;
+    m_workSpace.generation = generation;
+    return sWG;
 }
 
-void ShadowContext::freeWorkGroups()
+ShadowContext::GroupShard& ShadowContext::getGroupShard(const WorkGroup *workGroup) const
 {
-    if(m_workSpace.workGroups && !m_workSpace.workGroups->size())
-    {
-        delete m_workSpace.workGroups;
-        m_workSpace.workGroups = NULL;
-    }
+    size_t hash = std::hash<const WorkGroup*>()(workGroup);
+    return m_groupShards[(hash >> 4) % NUM_GROUP_SHARDS];
+}
+
+size_t ShadowContext::getLocalIndex(const WorkItem *workItem)
+{
+    Size3 lid = workItem->getLocalID();
+    Size3 groupSize = workItem->getWorkGroup()->getGroupSize();
+    return lid.x + (lid.y + lid.z*groupSize.y)*groupSize.x;
 }
 
 TypedValue ShadowContext::getCleanValue(unsigned size)
@@ -2687,6 +2887,41 @@ TypedValue ShadowContext::getValue(const WorkItem *workItem, const llvm::Value *
     }
 }
 
+const ShadowValueIndex* ShadowContext::getValueIndex(const llvm::Function *F) const
+{
+    return &m_valueIndices.at(F);
+}
+
+void ShadowContext::indexFunctions(const llvm::Function *kernel)
+{
+    // Number the values of every function the kernel may call, so that
+    // shadow frames can hold them in a flat register file
+    m_valueIndices.clear();
+    const llvm::Module *module = kernel->getParent();
+    for(auto F = module->begin(); F != module->end(); F++)
+    {
+        if(F->isDeclaration())
+        {
+            continue;
+        }
+
+        ShadowValueIndex& index = m_valueIndices[&*F];
+        for(auto A = F->arg_begin(); A != F->arg_end(); A++)
+        {
+            index.insert(std::make_pair(&*A, index.size()));
+        }
+        for(auto I = llvm::inst_begin(&*F); I != llvm::inst_end(&*F); I++)
+        {
+            if(!I->getType()->isVoidTy())
+            {
+                index.insert(std::make_pair(&*I, index.size()));
+            }
+        }
+    }
+
+    m_kernelIndex = getValueIndex(kernel);
+}
+
 bool ShadowContext::isCleanImage(const TypedValue shadowImage)
 {
     return (isCleanImageAddress(shadowImage) &&
@@ -2791,6 +3026,19 @@ bool ShadowContext::isCleanValue(TypedValue v, unsigned offset)
     return !memcmp(v.data + offset*v.size, c.data, v.size);
 }
 
+ShadowWorkItem* ShadowContext::getShadowWorkItem(const WorkItem *workItem) const
+{
+    ShadowWorkGroup *sWG = getShadowWorkGroup(workItem->getWorkGroup());
+    return sWG->getShadowWorkItem(getLocalIndex(workItem));
+}
+
+MemoryPool* ShadowContext::setMemoryPool(MemoryPool *pool)
+{
+    MemoryPool *previous = m_workSpace.memoryPool;
+    m_workSpace.memoryPool = pool;
+    return previous;
+}
+
 void ShadowContext::setGlobalValue(const llvm::Value *V, TypedValue SV)
 {
     assert(!m_globalValues.count(V) && "Values may only have one shadow");
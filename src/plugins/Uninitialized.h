@@ -10,6 +10,9 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IntrinsicInst.h"
 
+#include <atomic>
+#include <mutex>
+
 //#define DUMP_SHADOW
 //#define PARANOID_CHECK(W, I) assert(checkAllOperandsDefined(W, I) && "Not all operands defined")
 //#define PARANOID_CHECK(W, I) checkAllOperandsDefined(W, I)
@@ -19,10 +22,13 @@ namespace oclgrind
 {
     typedef std::unordered_map<const llvm::Value*, TypedValue> UnorderedTypedValueMap;
 
+    // Maps the arguments and instructions of a function to shadow registers
+    typedef std::unordered_map<const llvm::Value*, unsigned> ShadowValueIndex;
+
     class ShadowFrame
     {
         public:
-            ShadowFrame();
+            ShadowFrame(const ShadowValueIndex *index);
             virtual ~ShadowFrame();
 
             void dump() const;
@@ -33,7 +39,7 @@ namespace oclgrind
             TypedValue getValue(const llvm::Value *V) const;
             inline bool hasValue(const llvm::Value* V) const
             {
-                return llvm::isa<llvm::Constant>(V) || m_values->count(V);
+                return llvm::isa<llvm::Constant>(V) || findValue(V);
             }
             inline void setCall(const llvm::CallInst *CI)
             {
@@ -45,19 +51,23 @@ namespace oclgrind
             typedef std::list<const llvm::Value*> ValuesList;
 
             const llvm::CallInst *m_call;
-            UnorderedTypedValueMap *m_values;
+            const ShadowValueIndex *m_index;
+            std::vector<TypedValue> m_values;
+            UnorderedTypedValueMap *m_otherValues;
 #ifdef DUMP_SHADOW
             ValuesList *m_valuesList;
 #endif
+
+            const TypedValue* findValue(const llvm::Value *V) const;
     };
 
     class ShadowValues
     {
         public:
-            ShadowValues();
+            ShadowValues(const ShadowValueIndex *index);
             virtual ~ShadowValues();
 
-            ShadowFrame* createCleanShadowFrame();
+            ShadowFrame* createCleanShadowFrame(const ShadowValueIndex *index);
             inline void dump() const
             {
                 m_stack->top()->dump();
@@ -102,11 +112,20 @@ namespace oclgrind
     class ShadowMemory
     {
         public:
+            // One bit per byte, set if every bit of the byte is undefined
+            // Partially defined bytes are kept in a separate map, and each
+            // 64-byte chunk containing any of them is flagged
             struct Buffer
             {
                 size_t size;
                 cl_mem_flags flags;
-                unsigned char *data;
+                std::atomic<uint64_t> *poisoned;
+                std::atomic<uint64_t> *partialChunks;
+                std::unordered_map<size_t, unsigned char> partial;
+                std::mutex partialMutex;
+
+                Buffer(size_t size);
+                ~Buffer();
             };
 
             ShadowMemory(AddressSpace addrSpace, unsigned bufferBits);
@@ -114,7 +133,6 @@ namespace oclgrind
 
             void allocate(size_t address, size_t size);
             void dump() const;
-            void* getPointer(size_t address) const;
             bool isAddressValid(size_t address, size_t size=1) const;
             void load(unsigned char *dst, size_t address, size_t size=1) const;
             void lock(size_t address) const;
@@ -122,10 +140,11 @@ namespace oclgrind
             void unlock(size_t address) const;
 
         private:
-            typedef std::unordered_map<size_t, Buffer*> MemoryMap;
+            typedef std::vector<Buffer*> MemoryMap;
 
             AddressSpace m_addrSpace;
             MemoryMap m_map;
+            std::mutex m_allocMutex;
             unsigned m_numBitsAddress;
             unsigned m_numBitsBuffer;
 
@@ -138,7 +157,7 @@ namespace oclgrind
     class ShadowWorkItem
     {
         public:
-            ShadowWorkItem(unsigned bufferBits);
+            ShadowWorkItem(unsigned bufferBits, const ShadowValueIndex *index);
             virtual ~ShadowWorkItem();
 
             inline void dump() const
@@ -146,6 +165,10 @@ namespace oclgrind
                 m_values->dump();
                 m_memory->dump();
             }
+            inline MemoryPool* getMemoryPool()
+            {
+                return &m_pool;
+            }
             inline ShadowMemory* getPrivateMemory()
             {
                 return m_memory;
@@ -156,6 +179,7 @@ namespace oclgrind
             }
 
         private:
+            MemoryPool m_pool;
             ShadowMemory *m_memory;
             ShadowValues *m_values;
     };
@@ -163,7 +187,7 @@ namespace oclgrind
     class ShadowWorkGroup
     {
         public:
-            ShadowWorkGroup(unsigned bufferBits);
+            ShadowWorkGroup(unsigned bufferBits, size_t numWorkItems);
             virtual ~ShadowWorkGroup();
 
             inline void dump() const
@@ -174,9 +198,18 @@ namespace oclgrind
             {
                 return m_memory;
             }
+            inline ShadowWorkItem* getShadowWorkItem(size_t index) const
+            {
+                return m_workItems[index];
+            }
+            inline void setShadowWorkItem(size_t index, ShadowWorkItem *workItem)
+            {
+                m_workItems[index] = workItem;
+            }
 
         private:
             ShadowMemory *m_memory;
+            std::vector<ShadowWorkItem*> m_workItems;
     };
 
     class ShadowContext
@@ -185,8 +218,6 @@ namespace oclgrind
             ShadowContext(unsigned bufferBits);
             virtual ~ShadowContext();
 
-            void allocateWorkItems();
-            void allocateWorkGroups();
             void clearGlobalValues();
             void createMemoryPool();
             ShadowWorkItem* createShadowWorkItem(const WorkItem *workItem);
@@ -196,8 +227,6 @@ namespace oclgrind
             void destroyShadowWorkGroup(const WorkGroup *workGroup);
             void dump(const WorkItem *workItem) const;
             void dumpGlobalValues() const;
-            void freeWorkItems();
-            void freeWorkGroups();
             static TypedValue getCleanValue(unsigned size);
             static TypedValue getCleanValue(TypedValue v);
             static TypedValue getCleanValue(const llvm::Type *Ty);
@@ -215,19 +244,24 @@ namespace oclgrind
             static TypedValue getPoisonedValue(TypedValue v);
             static TypedValue getPoisonedValue(const llvm::Type *Ty);
             static TypedValue getPoisonedValue(const llvm::Value *V);
-            inline ShadowWorkItem* getShadowWorkItem(const WorkItem *workItem) const
-            {
-                return m_workSpace.workItems->at(workItem);
-            }
+            ShadowWorkItem* getShadowWorkItem(const WorkItem *workItem) const;
             inline ShadowWorkGroup* getShadowWorkGroup(const WorkGroup *workGroup) const
             {
-                return m_workSpace.workGroups->at(workGroup);
+                // Check the work-group this thread used last before locking
+                if(m_workSpace.context == this && m_workSpace.workGroup == workGroup &&
+                   m_workSpace.generation == m_generation.load(std::memory_order_acquire))
+                {
+                    return m_workSpace.shadowWorkGroup;
+                }
+                return findShadowWorkGroup(workGroup);
             }
             TypedValue getValue(const WorkItem *workItem, const llvm::Value *V) const;
+            const ShadowValueIndex* getValueIndex(const llvm::Function *F) const;
             inline bool hasValue(const WorkItem *workItem, const llvm::Value* V) const
             {
-                return llvm::isa<llvm::Constant>(V) || m_globalValues.count(V) || m_workSpace.workItems->at(workItem)->getValues()->hasValue(V);
+                return llvm::isa<llvm::Constant>(V) || m_globalValues.count(V) || getShadowWorkItem(workItem)->getValues()->hasValue(V);
             }
+            void indexFunctions(const llvm::Function *kernel);
             static bool isCleanImage(const TypedValue shadowImage);
             static bool isCleanImageAddress(const TypedValue shadowImage);
             static bool isCleanImageDescription(const TypedValue shadowImage);
@@ -237,22 +271,45 @@ namespace oclgrind
             static bool isCleanValue(TypedValue v);
             static bool isCleanValue(TypedValue v, unsigned offset);
             void setGlobalValue(const llvm::Value *V, TypedValue SV);
+            MemoryPool* setMemoryPool(MemoryPool *pool);
             static void shadowOr(TypedValue v1, TypedValue v2);
 
         private:
             ShadowMemory *m_globalMemory;
             UnorderedTypedValueMap m_globalValues;
+            std::unordered_map<const llvm::Function*, ShadowValueIndex> m_valueIndices;
+            const ShadowValueIndex *m_kernelIndex;
             unsigned m_numBitsBuffer;
-            typedef std::map<const WorkItem*, ShadowWorkItem*> ShadowItemMap;
-            typedef std::map<const WorkGroup*, ShadowWorkGroup*> ShadowGroupMap;
+
+            // Work-group shadows are shared by all workers, since work-items
+            // from one work-group may run on different threads
+            // Destroying a work-group shadow advances the generation, which
+            // invalidates the shadow each thread has cached
+            static const unsigned NUM_GROUP_SHARDS = 64;
+            typedef std::unordered_map<const WorkGroup*, ShadowWorkGroup*> ShadowGroupMap;
+            struct GroupShard
+            {
+                std::mutex mutex;
+                ShadowGroupMap workGroups;
+            };
+            mutable GroupShard m_groupShards[NUM_GROUP_SHARDS];
+            std::atomic<uint64_t> m_generation;
+
             struct WorkSpace
             {
-                ShadowItemMap *workItems;
-                ShadowGroupMap *workGroups;
+                const ShadowContext *context;
+                const WorkGroup *workGroup;
+                ShadowWorkGroup *shadowWorkGroup;
+                uint64_t generation;
                 MemoryPool *memoryPool;
+                MemoryPool *scratchPool;
                 unsigned poolUsers;
             };
             static THREAD_LOCAL WorkSpace m_workSpace;
+
+            ShadowWorkGroup* findShadowWorkGroup(const WorkGroup *workGroup) const;
+            GroupShard& getGroupShard(const WorkGroup *workGroup) const;
+            static size_t getLocalIndex(const WorkItem *workItem);
     };
 
     class Uninitialized : public Plugin
@@ -278,6 +335,9 @@ namespace oclgrind
             //virtual void memoryAllocated(const Memory *memory, size_t address,
             //                             size_t size, cl_mem_flags flags,
             //                             const uint8_t *initData);
+
+            virtual unsigned getEventMask() const override;
+            virtual bool supportsParallelWorkItems() const override;
         private:
             std::list<std::pair<const llvm::Value*, TypedValue> > m_deferredInit;
             std::list<std::pair<const llvm::Value*, TypedValue> > m_deferredInitGroup;
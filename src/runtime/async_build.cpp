@@ -0,0 +1,140 @@
+// async_build.cpp (Oclgrind)
+// Copyright (c) 2013-2016, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "async_build.h"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+  struct BuildJob
+  {
+    cl_program program;
+    function<void()> build;
+    void (CL_CALLBACK *notify)(cl_program, void*);
+    void *userData;
+  };
+
+  // Background compile threads, started on first use
+  struct BuildPool
+  {
+    mutex mtx;
+    condition_variable ready;
+    list<BuildJob> jobs;
+    set<cl_program> pending;
+    vector<thread> threads;
+    bool shutdown;
+
+    BuildPool() : shutdown(false) {}
+
+    ~BuildPool()
+    {
+      // Finish outstanding builds before stopping threads
+      {
+        lock_guard<mutex> lock(mtx);
+        shutdown = true;
+      }
+      ready.notify_all();
+      for (thread& t : threads)
+        t.join();
+    }
+
+    void start()
+    {
+      unsigned numThreads = thread::hardware_concurrency();
+      const char *env = getenv("OCLGRIND_BUILD_THREADS");
+      if (env)
+      {
+        char *next;
+        numThreads = strtoul(env, &next, 10);
+        if (strlen(next))
+        {
+          cerr << "Oclgrind: Invalid value for OCLGRIND_BUILD_THREADS"
+               << endl;
+        }
+      }
+      if (!numThreads)
+        numThreads = 1;
+
+      for (unsigned i = 0; i < numThreads; i++)
+        threads.push_back(thread(&BuildPool::run, this));
+    }
+
+    void run()
+    {
+      unique_lock<mutex> lock(mtx);
+      while (true)
+      {
+        ready.wait(lock, [this]{ return shutdown || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+
+        BuildJob job = jobs.front();
+        jobs.pop_front();
+        lock.unlock();
+
+        job.build();
+
+        // Mark build as complete before notifying the application, since
+        // the callback may release the program
+        endBuild(job.program);
+
+        if (job.notify)
+          job.notify(job.program, job.userData);
+        clReleaseProgram(job.program);
+
+        lock.lock();
+      }
+    }
+  } buildPool;
+}
+
+bool beginBuild(cl_program program)
+{
+  lock_guard<mutex> lock(buildPool.mtx);
+  return buildPool.pending.insert(program).second;
+}
+
+void endBuild(cl_program program)
+{
+  lock_guard<mutex> lock(buildPool.mtx);
+  buildPool.pending.erase(program);
+}
+
+void asyncBuild(cl_program program,
+                const function<void()>& build,
+                void (CL_CALLBACK *notify)(cl_program, void*),
+                void *userData)
+{
+  // Keep program alive until the build has completed
+  clRetainProgram(program);
+
+  BuildJob job = {program, build, notify, userData};
+  {
+    lock_guard<mutex> lock(buildPool.mtx);
+    if (buildPool.threads.empty())
+      buildPool.start();
+    buildPool.jobs.push_back(job);
+  }
+  buildPool.ready.notify_one();
+}
+
+bool asyncBuildPending(cl_program program)
+{
+  lock_guard<mutex> lock(buildPool.mtx);
+  return buildPool.pending.count(program);
+}
@@ -0,0 +1,22 @@
+// async_build.h (Oclgrind)
+// Copyright (c) 2013-2016, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "icd.h"
+
+#include <functional>
+
+// Mark a program as being built, failing if a build is already pending
+extern bool beginBuild(cl_program program);
+extern void endBuild(cl_program program);
+
+// Run a build started with beginBuild on a background thread
+extern void asyncBuild(cl_program program,
+                       const std::function<void()>& build,
+                       void (CL_CALLBACK *notify)(cl_program, void*),
+                       void *userData);
+extern bool asyncBuildPending(cl_program program);
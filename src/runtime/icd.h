@@ -113,6 +113,7 @@
 #define clCreateEventFromGLsyncKHR _clCreateEventFromGLsyncKHR
 #endif // OCLGRIND_ICD
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <stack>
@@ -196,7 +197,7 @@ struct _cl_program
   void *dispatch;
   oclgrind::Program *program;
   cl_context context;
-  unsigned int refCount;
+  std::atomic<unsigned int> refCount;
 };
 
 struct _cl_kernel
@@ -208,6 +208,15 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_BUILD_OPTIONS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--cache-dir"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --cache-dir" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_CACHE_DIR", argv[i]);
+    }
     else if (!strcmp(argv[i], "--check-api"))
     {
       setEnvironment("OCLGRIND_CHECK_API", "1");
@@ -224,6 +233,10 @@ static bool parseArguments(int argc, char *argv[])
     {
       setEnvironment("OCLGRIND_DUMP_SPIR", "1");
     }
+    else if (!strcmp(argv[i], "--group-registers"))
+    {
+      setEnvironment("OCLGRIND_GROUP_REGISTERS", "1");
+    }
     else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
     {
       printUsage();
@@ -237,6 +250,15 @@ static bool parseArguments(int argc, char *argv[])
     {
       setEnvironment("OCLGRIND_INTERACTIVE", "1");
     }
+    else if (!strcmp(argv[i], "--lockstep-width"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --lockstep-width" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_LOCKSTEP_WIDTH", argv[i]);
+    }
     else if (!strcmp(argv[i], "--log"))
     {
       if (++i >= argc)
@@ -255,6 +277,10 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_MAX_ERRORS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--no-instrumentation"))
+    {
+      setEnvironment("OCLGRIND_NO_INSTRUMENTATION", "1");
+    }
     else if (!strcmp(argv[i], "--num-threads"))
     {
       if (++i >= argc)
@@ -264,6 +290,19 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_NUM_THREADS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--opt-pipeline"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --opt-pipeline" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_OPT_PIPELINE", argv[i]);
+    }
+    else if (!strcmp(argv[i], "--parallel-work-items"))
+    {
+      setEnvironment("OCLGRIND_PARALLEL_WORK_ITEMS", "1");
+    }
     else if (!strcmp(argv[i], "--pch-dir"))
     {
       if (++i >= argc)
@@ -273,6 +312,10 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_PCH_DIR", argv[i]);
     }
+    else if (!strcmp(argv[i], "--pin-threads"))
+    {
+      setEnvironment("OCLGRIND_PIN_THREADS", "1");
+    }
     else if (!strcmp(argv[i], "--plugins"))
     {
       if (++i >= argc)
@@ -286,6 +329,18 @@ static bool parseArguments(int argc, char *argv[])
     {
       setEnvironment("OCLGRIND_QUICK", "1");
     }
+    else if (!strcmp(argv[i], "--skip-uniform"))
+    {
+      setEnvironment("OCLGRIND_SKIP_UNIFORM", "1");
+    }
+    else if (!strcmp(argv[i], "--stats"))
+    {
+      setEnvironment("OCLGRIND_STATS", "1");
+    }
+    else if (!strcmp(argv[i], "--time-passes"))
+    {
+      setEnvironment("OCLGRIND_TIME_PASSES", "1");
+    }
     else if (!strcmp(argv[i], "--uniform-writes"))
     {
       setEnvironment("OCLGRIND_UNIFORM_WRITES", "1");
@@ -415,6 +470,8 @@ static void printUsage()
     << "Options:" << endl
     << "     --build-options  OPTIONS  "
              "Additional options to pass to the OpenCL compiler" << endl
+    << "     --cache-dir      DIR      "
+             "Cache compiled programs in DIR" << endl
     << "     --check-api               "
              "Report errors on API calls" << endl
     << "     --data-races              "
@@ -423,24 +480,54 @@ static void printUsage()
              "Don't use precompiled headers" << endl
     << "     --dump-spir               "
              "Dump SPIR to /tmp/oclgrind_*.{ll,bc}" << endl
+    << "     --group-registers         "
+             "Store work-item values as arrays owned by each work-group" << endl
     << "  -h --help                    "
              "Display usage information" << endl
     << "     --inst-counts             "
              "Output histograms of instructions executed" << endl
     << "  -i --interactive             "
              "Enable interactive mode" << endl
+    << "     --lockstep-width NUM      "
+             "Run chunks of NUM work-items in lockstep" << endl
+    << "                               "
+             "(only when no plugin observes each instruction," << endl
+    << "                               "
+             " e.g. with --no-instrumentation)" << endl
     << "     --log            LOGFILE  "
              "Redirect log/error messages to a file" << endl
     << "     --max-errors     NUM      "
              "Limit the number of error/warning messages" << endl
+    << "     --no-instrumentation      "
+             "Disable plugins and error checking for faster execution" << endl
     << "     --num-threads    NUM      "
              "Set the number of worker threads to use" << endl
+    << "     --opt-pipeline   PRESET   "
+             "Optimization pipeline (default|compile|run|debug)" << endl
+    << "     --parallel-work-items     "
+             "Run work-items within a work-group in parallel" << endl
+    << "                               "
+             "(only when all plugins support it," << endl
+    << "                               "
+             " e.g. with --no-instrumentation)" << endl
     << "     --pch-dir        DIR      "
              "Override directory containing precompiled headers" << endl
+    << "     --pin-threads             "
+             "Pin each worker thread to a CPU core" << endl
     << "     --plugins        PLUGINS  "
              "Load colon separated list of plugin libraries" << endl
     << "  -q --quick                   "
              "Only run first and last work-group" << endl
+    << "     --skip-uniform            "
+             "Compute uniform instruction results once per work-group" << endl
+    << "                               "
+             "(only when no plugin observes each instruction," << endl
+    << "                               "
+             " e.g. with --no-instrumentation)" << endl
+    << "     --stats                   "
+             "Report program cache and execution statistics" << endl
+    << "     --time-passes             "
+             "Report time spent in each phase of program builds" << endl
     << "     --uniform-writes          "
              "Don't suppress uniform write-write data-races" << endl
     << "     --uninitialized           "
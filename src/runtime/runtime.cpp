@@ -14,6 +14,7 @@
 #include <iostream>
 #include <sstream>
 
+#include "async_build.h"
 #include "async_queue.h"
 #include "icd.h"
 
@@ -1231,6 +1232,8 @@ clCreateBuffer
   mem->flags = flags;
   mem->isImage = false;
   mem->refCount = 1;
+
+  lock_guard<recursive_mutex> lock(context->context->getGlobalMemoryMutex());
   if (flags & CL_MEM_USE_HOST_PTR)
   {
     mem->address = globalMemory->createHostBuffer(size, host_ptr, flags);
@@ -1648,8 +1651,11 @@ clReleaseMemObject
       }
       else
       {
-        memobj->context->context->getGlobalMemory()->deallocateBuffer(
-          memobj->address);
+        oclgrind::Context *context = memobj->context->context;
+        {
+          lock_guard<recursive_mutex> lock(context->getGlobalMemoryMutex());
+          context->getGlobalMemory()->deallocateBuffer(memobj->address);
+        }
         clReleaseContext(memobj->context);
       }
 
@@ -2384,9 +2390,26 @@ clBuildProgram
   {
     ReturnErrorArg(program->context, CL_INVALID_DEVICE, device);
   }
+  if (!beginBuild(program))
+  {
+    ReturnErrorInfo(program->context, CL_INVALID_OPERATION,
+                    "Previous build of program has not completed");
+  }
+
+  // Build program in the background if a callback was provided
+  if (pfn_notify)
+  {
+    string opts = options ? options : "";
+    asyncBuild(program,
+               [program, opts]{ program->program->build(opts.c_str()); },
+               pfn_notify, user_data);
+    return CL_SUCCESS;
+  }
 
   // Build program
-  if (!program->program->build(options))
+  bool success = program->program->build(options);
+  endBuild(program);
+  if (!success)
   {
     ReturnError(program->context, CL_BUILD_PROGRAM_FAILURE);
   }
@@ -2447,6 +2470,11 @@ clCompileProgram
   {
     ReturnErrorArg(program->context, CL_INVALID_DEVICE, device);
   }
+  if (!beginBuild(program))
+  {
+    ReturnErrorInfo(program->context, CL_INVALID_OPERATION,
+                    "Previous build of program has not completed");
+  }
 
   // Prepare headers
   list<oclgrind::Program::Header> headers;
@@ -2456,8 +2484,31 @@ clCompileProgram
                                 input_headers[i]->program));
   }
 
+  // Compile program in the background if a callback was provided
+  if (pfn_notify)
+  {
+    // Keep header programs alive until the compile has completed
+    vector<cl_program> headerPrograms(input_headers,
+                                      input_headers + num_input_headers);
+    for (cl_program header : headerPrograms)
+      clRetainProgram(header);
+
+    string opts = options ? options : "";
+    asyncBuild(program,
+               [program, opts, headers, headerPrograms]
+               {
+                 program->program->build(opts.c_str(), headers);
+                 for (cl_program header : headerPrograms)
+                   clReleaseProgram(header);
+               },
+               pfn_notify, user_data);
+    return CL_SUCCESS;
+  }
+
   // Build program
-  if (!program->program->build(options, headers))
+  bool success = program->program->build(options, headers);
+  endBuild(program);
+  if (!success)
   {
     ReturnError(program->context, CL_BUILD_PROGRAM_FAILURE);
   }
@@ -2519,6 +2570,12 @@ clLinkProgram
   list<const oclgrind::Program*> programs;
   for (unsigned i = 0; i < num_input_programs; i++)
   {
+    if (asyncBuildPending(input_programs[i]))
+    {
+      SetErrorInfo(context, CL_INVALID_OPERATION,
+                   "Compilation of input program has not completed");
+      return NULL;
+    }
     programs.push_back(input_programs[i]->program);
   }
 
@@ -2572,9 +2629,11 @@ clGetProgramInfo
   {
     ReturnErrorArg(NULL, CL_INVALID_PROGRAM, program);
   }
+  bool pending = asyncBuildPending(program);
   if ((param_name == CL_PROGRAM_NUM_KERNELS ||
        param_name == CL_PROGRAM_KERNEL_NAMES) &&
-      program->program->getBuildStatus() != CL_BUILD_SUCCESS)
+      (pending ||
+       program->program->getBuildStatus() != CL_BUILD_SUCCESS))
   {
     ReturnErrorInfo(program->context, CL_INVALID_PROGRAM_EXECUTABLE,
                     "Program not successfully built");
@@ -2615,8 +2674,12 @@ clGetProgramInfo
     result_size = strlen(str) + 1;
     break;
   case CL_PROGRAM_BINARY_SIZES:
+    // Binary is not available until the build has completed
     result_size = sizeof(size_t);
-    result_data.sizet = program->program->getBinarySize();
+    if (pending)
+      result_data.sizet = 0;
+    else
+      result_data.sizet = program->program->getBinarySize();
     break;
   case CL_PROGRAM_BINARIES:
     result_size = sizeof(unsigned char*);
@@ -2654,7 +2717,8 @@ clGetProgramInfo
     }
     else if (param_name == CL_PROGRAM_BINARIES)
     {
-      program->program->getBinary(((unsigned char**)param_value)[0]);
+      if (!pending)
+        program->program->getBinary(((unsigned char**)param_value)[0]);
     }
     else
     {
@@ -2695,18 +2759,30 @@ clGetProgramBuildInfo
   } result_data;
   const char* str = 0;
 
+  // Build results are not available until the build has completed
+  bool pending = asyncBuildPending(program);
+
   switch (param_name)
   {
   case CL_PROGRAM_BUILD_STATUS:
     result_size = sizeof(cl_build_status);
-    result_data.status = program->program->getBuildStatus();
+    if (pending)
+      result_data.status = CL_BUILD_IN_PROGRESS;
+    else
+      result_data.status = program->program->getBuildStatus();
     break;
   case CL_PROGRAM_BUILD_OPTIONS:
-    str = program->program->getBuildOptions().c_str();
+    if (pending)
+      str = "";
+    else
+      str = program->program->getBuildOptions().c_str();
     result_size = strlen(str) + 1;
     break;
   case CL_PROGRAM_BUILD_LOG:
-    str = program->program->getBuildLog().c_str();
+    if (pending)
+      str = "";
+    else
+      str = program->program->getBuildLog().c_str();
     result_size = strlen(str) + 1;
     break;
   case CL_PROGRAM_BINARY_TYPE:
@@ -2715,7 +2791,10 @@ clGetProgramBuildInfo
     break;
   case CL_PROGRAM_BUILD_GLOBAL_VARIABLE_TOTAL_SIZE:
     result_size = sizeof(size_t);
-    result_data.sizet = program->program->getTotalProgramScopeVarSize();
+    if (pending)
+      result_data.sizet = 0;
+    else
+      result_data.sizet = program->program->getTotalProgramScopeVarSize();
     break;
   default:
     ReturnErrorArg(program->context, CL_INVALID_VALUE, param_name);
@@ -2760,6 +2839,12 @@ clCreateKernel
     SetErrorArg(program->context, CL_INVALID_VALUE, kernel_name);
     return NULL;
   }
+  if (asyncBuildPending(program))
+  {
+    SetErrorInfo(program->context, CL_INVALID_PROGRAM_EXECUTABLE,
+                 "Program build has not completed");
+    return NULL;
+  }
 
   // Create kernel object
   cl_kernel kernel = new _cl_kernel;
@@ -2795,7 +2880,8 @@ clCreateKernelsInProgram
   {
     ReturnErrorArg(NULL, CL_INVALID_PROGRAM, program);
   }
-  if (program->program->getBuildStatus() != CL_BUILD_SUCCESS)
+  if (asyncBuildPending(program) ||
+      program->program->getBuildStatus() != CL_BUILD_SUCCESS)
   {
     ReturnErrorInfo(program->context, CL_INVALID_PROGRAM_EXECUTABLE,
                     "Program not built");
@@ -4635,8 +4721,12 @@ clEnqueueMapBuffer
   }
 
   // Map buffer
-  void *ptr = buffer->context->context->getGlobalMemory()->mapBuffer(
-    buffer->address, offset, cb);
+  void *ptr;
+  {
+    oclgrind::Context *context = buffer->context->context;
+    lock_guard<recursive_mutex> lock(context->getGlobalMemoryMutex());
+    ptr = context->getGlobalMemory()->mapBuffer(buffer->address, offset, cb);
+  }
   if (ptr == NULL)
   {
     SetError(command_queue->context, CL_INVALID_VALUE);
@@ -4762,8 +4852,12 @@ clEnqueueMapImage
               + (region[2]-1) * slice_pitch;
 
   // Map image
-  void *ptr = image->context->context->getGlobalMemory()->mapBuffer(
-        image->address, offset, size);
+  void *ptr;
+  {
+    oclgrind::Context *context = image->context->context;
+    lock_guard<recursive_mutex> lock(context->getGlobalMemoryMutex());
+    ptr = context->getGlobalMemory()->mapBuffer(image->address, offset, size);
+  }
   if (ptr == NULL)
   {
     SetError(command_queue->context, CL_INVALID_VALUE);
@@ -0,0 +1,105 @@
+// Micro-benchmarks for each family of arithmetic and comparison
+// instructions, in scalar and vector forms.
+
+kernel void int_arith(global uint *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  uint a = data[i];
+  uint b = a ^ 0x5A5A5A5A;
+  for (uint n = 0; n < iterations; n++)
+  {
+    a = a*b + (a - n);
+    b = (b & a) | (a ^ n);
+  }
+  data[i] = a + b;
+}
+
+kernel void int4_arith(global uint4 *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  uint4 a = data[i];
+  uint4 b = a ^ 0x5A5A5A5A;
+  for (uint n = 0; n < iterations; n++)
+  {
+    a = a*b + (a - n);
+    b = (b & a) | (a ^ n);
+  }
+  data[i] = a + b;
+}
+
+kernel void long_arith(global ulong *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  ulong a = data[i];
+  ulong b = a ^ 0x5A5A5A5A5A5A5A5A;
+  for (uint n = 0; n < iterations; n++)
+  {
+    a = a*b + (a - n);
+    b = (b & a) | (a ^ n);
+  }
+  data[i] = a + b;
+}
+
+kernel void float_arith(global float *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  float a = data[i];
+  float b = a + 1.5f;
+  for (uint n = 0; n < iterations; n++)
+  {
+    a = a*0.5f + b/3.0f;
+    b = b - a*0.25f;
+  }
+  data[i] = a + b;
+}
+
+kernel void float4_arith(global float4 *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  float4 a = data[i];
+  float4 b = a + 1.5f;
+  for (uint n = 0; n < iterations; n++)
+  {
+    a = a*0.5f + b/3.0f;
+    b = b - a*0.25f;
+  }
+  data[i] = a + b;
+}
+
+kernel void double2_arith(global double2 *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  double2 a = data[i];
+  double2 b = a + 1.5;
+  for (uint n = 0; n < iterations; n++)
+  {
+    a = a*0.5 + b/3.0;
+    b = b - a*0.25;
+  }
+  data[i] = a + b;
+}
+
+kernel void int_compare(global int *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  int a = data[i];
+  int count = 0;
+  for (uint n = 0; n < iterations; n++)
+  {
+    count += (a < (int)n) + (a != count) + ((uint)a >= n);
+  }
+  data[i] = count;
+}
+
+kernel void float4_compare(global float4 *data, uint iterations)
+{
+  size_t i = get_global_id(0);
+  float4 a = data[i];
+  int4 count = 0;
+  for (uint n = 0; n < iterations; n++)
+  {
+    float4 b = (float4)(n);
+    count -= (a < b) + (a != b) + (a >= b);
+  }
+  data[i] = convert_float4(count);
+}
@@ -0,0 +1,13 @@
+kernel void vector_overlap_race(global int *data, local int4 *scratch)
+{
+  int l = get_local_id(0);
+  if (l == 0)
+  {
+    *scratch = (int4)(1, 2, 3, 4);
+  }
+  else
+  {
+    data[l] = ((local int*)scratch)[2];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+}
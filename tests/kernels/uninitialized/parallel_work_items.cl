@@ -0,0 +1,8 @@
+kernel void parallel_work_items(global int *input, global int *output)
+{
+  int i = get_global_id(0);
+  if (i == 5)
+    output[i] = *input;
+  else
+    output[i] = i;
+}
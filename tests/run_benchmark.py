@@ -0,0 +1,76 @@
+# run_benchmark.py (Oclgrind)
+# Copyright (c) 2013-2016, James Price and Simon McIntosh-Smith,
+# University of Bristol. All rights reserved.
+#
+# This program is provided under a three-clause BSD license. For full
+# license terms please see the LICENSE file distributed with this
+# source code.
+
+# Compares the time taken to simulate each kernel test when work-items are
+# run to the next barrier against per-instruction stepping.
+
+import os
+import subprocess
+import sys
+import time
+
+# Check arguments
+if len(sys.argv) < 2 or len(sys.argv) > 3:
+  print('Usage: python run_benchmark.py OCLGRIND-KERNEL [REPETITIONS]')
+  sys.exit(1)
+
+oclgrind_exe = os.path.abspath(sys.argv[1])
+repetitions  = int(sys.argv[2]) if len(sys.argv) > 2 else 3
+kernels_dir  = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            'kernels')
+
+def run(test, single_step):
+  env = dict(os.environ)
+  if single_step:
+    env['OCLGRIND_SINGLE_STEP'] = '1'
+  else:
+    env.pop('OCLGRIND_SINGLE_STEP', None)
+
+  test_dir  = os.path.join(kernels_dir, os.path.dirname(test))
+  test_file = os.path.basename(test) + '.sim'
+  test_inp  = os.path.join(kernels_dir, test + '.inp')
+
+  cmd = [oclgrind_exe]
+
+  # Add any additional arguments specified in the test file
+  first_line = open(os.path.join(test_dir, test_file)).readline()[:-1]
+  if first_line[:7] == '# ARGS:':
+    cmd.extend(first_line[8:].split(' '))
+  cmd.append(test_file)
+
+  # Take the fastest of several runs
+  best = None
+  for i in range(repetitions):
+    inp = open(test_inp, 'r') if os.path.isfile(test_inp) else None
+    devnull = open(os.devnull, 'w')
+    start = time.time()
+    subprocess.call(cmd, cwd=test_dir, env=env,
+                    stdout=devnull, stderr=devnull, stdin=inp)
+    elapsed = time.time() - start
+    devnull.close()
+    if inp:
+      inp.close()
+    if best is None or elapsed < best:
+      best = elapsed
+  return best
+
+tests = open(os.path.join(kernels_dir, 'TESTS')).read().splitlines()
+tests = [test for test in tests if test]
+
+total_step = 0.0
+total_run  = 0.0
+print('%-50s %10s %10s %8s' % ('Kernel', 'step (s)', 'run (s)', 'Speedup'))
+for test in tests:
+  t_step = run(test, True)
+  t_run  = run(test, False)
+  total_step += t_step
+  total_run  += t_run
+  print('%-50s %10.3f %10.3f %7.2fx' % (test, t_step, t_run, t_step/t_run))
+
+print('%-50s %10.3f %10.3f %7.2fx' %
+      ('Total', total_step, total_run, total_step/total_run))
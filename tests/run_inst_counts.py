@@ -0,0 +1,79 @@
+# run_inst_counts.py (Oclgrind)
+# Copyright (c) 2013-2016, James Price and Simon McIntosh-Smith,
+# University of Bristol. All rights reserved.
+#
+# This program is provided under a three-clause BSD license. For full
+# license terms please see the LICENSE file distributed with this
+# source code.
+
+# Compares the number of instructions executed by each kernel test with and
+# without interpreter-oriented IR canonicalization.
+
+import os
+import re
+import subprocess
+import sys
+
+# Check arguments
+if len(sys.argv) != 2:
+  print('Usage: python run_inst_counts.py OCLGRIND-KERNEL')
+  sys.exit(1)
+
+oclgrind_exe = os.path.abspath(sys.argv[1])
+kernels_dir  = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            'kernels')
+
+count_line = re.compile(r'^\s*([0-9,.\' ]+) - ')
+
+def run(test, canonicalize):
+  env = dict(os.environ)
+  if canonicalize:
+    env.pop('OCLGRIND_DISABLE_CANONICALIZATION', None)
+  else:
+    env['OCLGRIND_DISABLE_CANONICALIZATION'] = '1'
+
+  test_dir  = os.path.join(kernels_dir, os.path.dirname(test))
+  test_file = os.path.basename(test) + '.sim'
+  test_inp  = os.path.join(kernels_dir, test + '.inp')
+
+  cmd = [oclgrind_exe, '--inst-counts']
+
+  # Add any additional arguments specified in the test file
+  first_line = open(os.path.join(test_dir, test_file)).readline()[:-1]
+  if first_line[:7] == '# ARGS:':
+    cmd.extend(first_line[8:].split(' '))
+  cmd.append(test_file)
+
+  # Sum instruction counts over all kernel invocations
+  inp = open(test_inp, 'r') if os.path.isfile(test_inp) else None
+  devnull = open(os.devnull, 'w')
+  output = subprocess.Popen(cmd, cwd=test_dir, env=env, stdout=subprocess.PIPE,
+                            stderr=devnull, stdin=inp).communicate()[0]
+  devnull.close()
+  if inp:
+    inp.close()
+
+  total = 0
+  for line in output.decode('utf-8', 'replace').splitlines():
+    match = count_line.match(line)
+    if match:
+      total += int(re.sub(r'[^0-9]', '', match.group(1)))
+  return total
+
+tests = open(os.path.join(kernels_dir, 'TESTS')).read().splitlines()
+tests = [test for test in tests if test]
+
+total_before = 0
+total_after  = 0
+print('%-50s %12s %12s %8s' % ('Kernel', 'original', 'canonical', 'Change'))
+for test in tests:
+  before = run(test, False)
+  after  = run(test, True)
+  total_before += before
+  total_after  += after
+  change = (after - before) * 100.0 / before if before else 0.0
+  print('%-50s %12d %12d %7.1f%%' % (test, before, after, change))
+
+change = (total_after - total_before) * 100.0 / total_before \
+         if total_before else 0.0
+print('%-50s %12d %12d %7.1f%%' % ('Total', total_before, total_after, change))
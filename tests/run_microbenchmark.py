@@ -0,0 +1,63 @@
+# run_microbenchmark.py (Oclgrind)
+# Copyright (c) 2013-2016, James Price and Simon McIntosh-Smith,
+# University of Bristol. All rights reserved.
+#
+# This program is provided under a three-clause BSD license. For full
+# license terms please see the LICENSE file distributed with this
+# source code.
+
+# Compares the time taken to simulate each instruction family micro-benchmark
+# with generic instruction handlers against type-specialised handlers.
+
+import os
+import subprocess
+import sys
+import time
+
+# Check arguments
+if len(sys.argv) < 2 or len(sys.argv) > 3:
+  print('Usage: python run_microbenchmark.py OCLGRIND-KERNEL [REPETITIONS]')
+  sys.exit(1)
+
+oclgrind_exe   = os.path.abspath(sys.argv[1])
+repetitions    = int(sys.argv[2]) if len(sys.argv) > 2 else 3
+benchmarks_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              'benchmarks')
+
+def run(benchmark, generic):
+  env = dict(os.environ)
+  if generic:
+    env['OCLGRIND_GENERIC_HANDLERS'] = '1'
+  else:
+    env.pop('OCLGRIND_GENERIC_HANDLERS', None)
+
+  # Take the fastest of several runs
+  best = None
+  for i in range(repetitions):
+    devnull = open(os.devnull, 'w')
+    start = time.time()
+    subprocess.call([oclgrind_exe, benchmark], cwd=benchmarks_dir, env=env,
+                    stdout=devnull, stderr=devnull)
+    elapsed = time.time() - start
+    devnull.close()
+    if best is None or elapsed < best:
+      best = elapsed
+  return best
+
+benchmarks = sorted([f for f in os.listdir(benchmarks_dir)
+                     if f.endswith('.sim')])
+
+total_generic = 0.0
+total_typed   = 0.0
+print('%-30s %12s %10s %8s' % ('Benchmark', 'generic (s)', 'typed (s)',
+                                'Speedup'))
+for benchmark in benchmarks:
+  t_generic = run(benchmark, True)
+  t_typed   = run(benchmark, False)
+  total_generic += t_generic
+  total_typed   += t_typed
+  print('%-30s %12.3f %10.3f %7.2fx' % (benchmark[:-4], t_generic, t_typed,
+                                        t_generic/t_typed))
+
+print('%-30s %12.3f %10.3f %7.2fx' %
+      ('Total', total_generic, total_typed, total_generic/total_typed))
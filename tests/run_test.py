@@ -82,15 +82,24 @@ def run(output_suffix):
     os.chdir(test_dir)
 
     cmd = [oclgrind_exe]
-
-    # Add any additional arguments specified in the test file
-    first_line = open(test_file).readline()[:-1]
-    if first_line[:7] == '# ARGS:':
-        cmd.extend(first_line[8:].split(' '))
+    env = dict(os.environ)
+
+    # Add any additional arguments and environment variables specified in
+    # the leading comments of the test file
+    for line in open(test_file).read().splitlines():
+      if line[:7] == '# ARGS:':
+        cmd.extend(line[8:].split(' '))
+      elif line[:6] == '# ENV:':
+        for var in line[7:].split(' '):
+          name, value = var.split('=', 1)
+          env[name] = value
+      elif line[:1] != '#':
+        break
 
     cmd.append(test_file)
 
-    retval = subprocess.call(cmd, stdout=out, stderr=out, stdin=inp)
+    retval = subprocess.call(cmd, stdout=out, stderr=out, stdin=inp,
+                             env=env)
 
     os.chdir(current_dir)
   else:
@@ -0,0 +1,36 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const char *SOURCE =
+"kernel void test_kernel(global int *out) \n"
+"{                                        \n"
+"  *out = 42;                             \n"
+"}                                        \n"
+;
+
+int main(int argc, char *argv[])
+{
+  cl_int err;
+  cl_program program;
+
+  // First build of the source is compiled and stored in the cache
+  Context cl = createContext(SOURCE, "");
+
+  // Second build of the same source is loaded from the cache
+  program = clCreateProgramWithSource(cl.context, 1, &SOURCE, NULL, &err);
+  checkError(err, "creating program");
+  err = clBuildProgram(program, 1, &cl.device, "", NULL, NULL);
+  checkError(err, "building program");
+
+  cl_build_status status;
+  err = clGetProgramBuildInfo(program, cl.device, CL_PROGRAM_BUILD_STATUS,
+                              sizeof(status), &status, NULL);
+  checkError(err, "getting build status");
+  printf("status = %d\n", status);
+
+  clReleaseProgram(program);
+  releaseContext(cl);
+  return 0;
+}